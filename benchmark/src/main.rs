@@ -0,0 +1,346 @@
+// Native driver for the pyhost marshalling benchmarks, mirroring
+// BenchmarkPythonHost so numbers can be compared without the JVM.
+//
+//     cargo run --release -- [--wasm <file>] [--guest <dir>] [--rows <count>] [--seconds <time>]
+
+use std::path::PathBuf;
+use std::time::{Duration, Instant};
+
+use anyhow::{anyhow, bail, Context, Result};
+use wasmtime::{Caller, Engine, InstancePre, Linker, Memory, Module, Store, TypedFunc};
+use wasmtime_wasi::p1::{self, WasiP1Ctx};
+use wasmtime_wasi::{DirPerms, FilePerms, WasiCtxBuilder};
+
+// type codes from pyhost.h
+const ROW: i32 = 0;
+const ARRAY: i32 = 1;
+const MAP: i32 = 2;
+const BOOLEAN: i32 = 3;
+const BIGINT: i32 = 4;
+const INTEGER: i32 = 5;
+const SMALLINT: i32 = 6;
+const TINYINT: i32 = 7;
+const DOUBLE: i32 = 8;
+const REAL: i32 = 9;
+const DECIMAL: i32 = 10;
+const VARCHAR: i32 = 11;
+const VARBINARY: i32 = 12;
+const DATE: i32 = 13;
+const TIME: i32 = 14;
+const TIME_WITH_TIME_ZONE: i32 = 15;
+const TIMESTAMP: i32 = 16;
+const TIMESTAMP_WITH_TIME_ZONE: i32 = 17;
+const INTERVAL_YEAR_TO_MONTH: i32 = 18;
+const INTERVAL_DAY_TO_SECOND: i32 = 19;
+const JSON: i32 = 20;
+const UUID: i32 = 21;
+const IPADDRESS: i32 = 22;
+const NUMBER: i32 = 23;
+const UNSCALED_DECIMAL: i32 = 24;
+
+struct Options {
+    wasm: PathBuf,
+    guest: PathBuf,
+    rows: i32,
+    duration: Duration,
+}
+
+struct BenchmarkType {
+    name: &'static str,
+    descriptor: Vec<i32>,
+    value: Vec<u8>,
+}
+
+fn string(value: &mut Vec<u8>, text: &[u8]) {
+    value.extend_from_slice(&(text.len() as i32).to_le_bytes());
+    value.extend_from_slice(text);
+}
+
+fn benchmark_types() -> Vec<BenchmarkType> {
+    let scalar = |name, descriptor: &[i32], value: &[u8]| BenchmarkType {
+        name,
+        descriptor: descriptor.to_vec(),
+        value: value.to_vec(),
+    };
+    let text = |name, code, text: &str| {
+        let mut value = Vec::new();
+        string(&mut value, text.as_bytes());
+        BenchmarkType {
+            name,
+            descriptor: vec![code],
+            value,
+        }
+    };
+
+    let mut array = 16i32.to_le_bytes().to_vec();
+    for i in 0..16i64 {
+        array.push(1);
+        array.extend_from_slice(&i.to_le_bytes());
+    }
+
+    let mut nested = vec![1];
+    nested.extend_from_slice(&4i32.to_le_bytes());
+    for i in 0..4 {
+        nested.push(1);
+        string(&mut nested, format!("element{i}").as_bytes());
+    }
+    nested.push(1);
+    nested.extend_from_slice(&4i32.to_le_bytes());
+    for i in 0..4i64 {
+        nested.push(1);
+        string(&mut nested, format!("key{i}").as_bytes());
+        nested.push(1);
+        nested.extend_from_slice(&i.to_le_bytes());
+    }
+
+    let with_zone = |micros: i64, offset: i16| [&micros.to_le_bytes()[..], &offset.to_le_bytes()[..]].concat();
+    let mut ipaddress = vec![0u8; 10];
+    ipaddress.extend_from_slice(&[0xff, 0xff, 192, 168, 0, 1]);
+
+    vec![
+        scalar("BOOLEAN", &[BOOLEAN], &[1]),
+        scalar("BIGINT", &[BIGINT], &1234567890123i64.to_le_bytes()),
+        scalar("INTEGER", &[INTEGER], &123456789i32.to_le_bytes()),
+        scalar("SMALLINT", &[SMALLINT], &12345i16.to_le_bytes()),
+        scalar("TINYINT", &[TINYINT], &[123]),
+        scalar("DOUBLE", &[DOUBLE], &std::f64::consts::PI.to_le_bytes()),
+        scalar("REAL", &[REAL], &std::f32::consts::E.to_le_bytes()),
+        text("DECIMAL", DECIMAL, "12345678.90"),
+        scalar(
+            "UNSCALED_DECIMAL(10,2)",
+            &[UNSCALED_DECIMAL, 10, 2],
+            &1234567890i64.to_le_bytes(),
+        ),
+        text("NUMBER", NUMBER, "3.14159265358979323846"),
+        text("VARCHAR", VARCHAR, "The quick brown fox jumps over the lazy dog"),
+        text("VARBINARY", VARBINARY, "\0\x01\x02\x03\x04\x05\x06\x07"),
+        text("JSON", JSON, r#"{"name": "trino", "tags": [1, 2, 3]}"#),
+        scalar("DATE", &[DATE], &20000i32.to_le_bytes()),
+        scalar("TIME", &[TIME], &45_296_789_000i64.to_le_bytes()),
+        scalar(
+            "TIME WITH TIME ZONE",
+            &[TIME_WITH_TIME_ZONE],
+            &with_zone(45_296_789_000, -300),
+        ),
+        scalar("TIMESTAMP", &[TIMESTAMP], &1_700_000_000_123_456i64.to_le_bytes()),
+        scalar(
+            "TIMESTAMP WITH TIME ZONE",
+            &[TIMESTAMP_WITH_TIME_ZONE],
+            &with_zone(1_700_000_000_123_456, 60),
+        ),
+        scalar(
+            "INTERVAL YEAR TO MONTH",
+            &[INTERVAL_YEAR_TO_MONTH],
+            &27i32.to_le_bytes(),
+        ),
+        scalar(
+            "INTERVAL DAY TO SECOND",
+            &[INTERVAL_DAY_TO_SECOND],
+            &93_784_005i64.to_le_bytes(),
+        ),
+        scalar("UUID", &[UUID], &0x0123456789abcdef_fedcba9876543210u128.to_le_bytes()),
+        scalar("IPADDRESS", &[IPADDRESS], &ipaddress),
+        scalar("ARRAY(BIGINT)", &[ARRAY, BIGINT], &array),
+        scalar(
+            "ROW(ARRAY(VARCHAR), MAP(VARCHAR, BIGINT))",
+            &[ROW, 2, ARRAY, VARCHAR, MAP, VARCHAR, BIGINT],
+            &nested,
+        ),
+    ]
+}
+
+struct Host {
+    store: Store<WasiP1Ctx>,
+    memory: Memory,
+    allocate: TypedFunc<i32, i32>,
+    deallocate: TypedFunc<i32, ()>,
+    setup: TypedFunc<(i32, i32, i32), i32>,
+    execute: TypedFunc<i32, i32>,
+    execute_batch: TypedFunc<(i32, i32), i32>,
+}
+
+impl Host {
+    fn new(engine: &Engine, pre: &InstancePre<WasiP1Ctx>, options: &Options) -> Result<Host> {
+        let wasi = WasiCtxBuilder::new()
+            .inherit_stdio()
+            .preopened_dir(&options.guest, "/guest", DirPerms::READ, FilePerms::READ)?
+            .build_p1();
+        let mut store = Store::new(engine, wasi);
+        let instance = pre.instantiate(&mut store)?;
+        let memory = instance
+            .get_memory(&mut store, "memory")
+            .ok_or_else(|| anyhow!("memory not exported"))?;
+        Ok(Host {
+            memory,
+            allocate: instance.get_typed_func(&mut store, "allocate")?,
+            deallocate: instance.get_typed_func(&mut store, "deallocate")?,
+            setup: instance.get_typed_func(&mut store, "setup")?,
+            execute: instance.get_typed_func(&mut store, "execute")?,
+            execute_batch: instance.get_typed_func(&mut store, "execute_batch")?,
+            store,
+        })
+    }
+
+    fn write(&mut self, bytes: &[u8]) -> Result<i32> {
+        let address = self.allocate.call(&mut self.store, bytes.len() as i32)?;
+        self.memory.write(&mut self.store, address as usize, bytes)?;
+        Ok(address)
+    }
+
+    fn write_type(&mut self, descriptor: &[i32]) -> Result<i32> {
+        let bytes: Vec<u8> = descriptor.iter().flat_map(|value| value.to_le_bytes()).collect();
+        self.write(&bytes)
+    }
+
+    fn setup(&mut self, name: &str, arg_type: &[i32], return_type: &[i32]) -> Result<i32> {
+        let name = self.write(&[name.as_bytes(), &[0]].concat())?;
+        let arg_type = self.write_type(arg_type)?;
+        let return_type = self.write_type(return_type)?;
+        let handle = self.setup.call(&mut self.store, (name, arg_type, return_type))?;
+        for address in [name, arg_type, return_type] {
+            self.deallocate.call(&mut self.store, address)?;
+        }
+        Ok(handle)
+    }
+}
+
+fn argument_type(descriptor: &[i32]) -> Vec<i32> {
+    [&[ROW, 1][..], descriptor].concat()
+}
+
+// argument record: present row with one present field
+fn record(value: &[u8]) -> Vec<u8> {
+    [&[1, 1][..], value].concat()
+}
+
+// runs the operation until the duration has passed and returns the time per row
+fn measure(duration: Duration, rows: u64, mut operation: impl FnMut() -> Result<()>) -> Result<f64> {
+    let warmup = Instant::now();
+    while warmup.elapsed() < duration / 4 {
+        operation()?;
+    }
+    let start = Instant::now();
+    let mut count = 0u64;
+    while start.elapsed() < duration {
+        operation()?;
+        count += rows;
+    }
+    Ok(start.elapsed().as_nanos() as f64 / count as f64)
+}
+
+fn parse_options() -> Result<Options> {
+    let root = PathBuf::from(env!("CARGO_MANIFEST_DIR")).join("..");
+    let mut options = Options {
+        wasm: root.join("target/wasm/python-host-opt.wasm"),
+        guest: root.join("src/test/resources/benchmark"),
+        rows: 1024,
+        duration: Duration::from_secs(2),
+    };
+    let mut args = std::env::args().skip(1);
+    while let Some(arg) = args.next() {
+        let mut value = || args.next().with_context(|| format!("missing value for {arg}"));
+        match arg.as_str() {
+            "--wasm" => options.wasm = value()?.into(),
+            "--guest" => options.guest = value()?.into(),
+            "--rows" => options.rows = value()?.parse()?,
+            "--seconds" => options.duration = Duration::from_secs_f64(value()?.parse()?),
+            _ => bail!("unknown option {arg}"),
+        }
+    }
+    Ok(options)
+}
+
+fn main() -> Result<()> {
+    let options = parse_options()?;
+
+    let engine = Engine::default();
+    let module = Module::from_file(&engine, &options.wasm)
+        .with_context(|| format!("failed to load {}", options.wasm.display()))?;
+    let mut linker: Linker<WasiP1Ctx> = Linker::new(&engine);
+    p1::add_to_linker_sync(&mut linker, |context| context)?;
+    linker.func_wrap(
+        "trino",
+        "return_error",
+        |mut caller: Caller<'_, WasiP1Ctx>,
+         code: i32,
+         message: i32,
+         size: i32,
+         _traceback: i32,
+         _traceback_size: i32|
+         -> Result<()> {
+            let memory = caller
+                .get_export("memory")
+                .and_then(|export| export.into_memory())
+                .unwrap();
+            let bytes = &memory.data(&caller)[message as usize..(message + size) as usize];
+            bail!("guest error {code}: {}", String::from_utf8_lossy(bytes))
+        },
+    )?;
+    // the benchmarks pass no streamed arguments
+    linker.func_wrap(
+        "trino",
+        "read_chunk",
+        |_stream: i32, _buffer: i32, _capacity: i32| -> i32 { -1 },
+    )?;
+    let pre = linker.instantiate_pre(&module)?;
+
+    let mut times = Vec::new();
+    for _ in 0..20 {
+        let start = Instant::now();
+        let mut host = Host::new(&engine, &pre, &options)?;
+        host.setup("identity", &argument_type(&[BIGINT]), &[BIGINT])?;
+        times.push(start.elapsed());
+    }
+    times.sort();
+    println!(
+        "cold start (instantiate + setup): median {:.3} ms",
+        times[times.len() / 2].as_secs_f64() * 1000.0
+    );
+
+    println!(
+        "{:<44} {:<10} {:>14} {:>14}",
+        "type", "function", "execute ns", "batch ns/row"
+    );
+    for benchmark in benchmark_types() {
+        for function in ["identity", "is_null"] {
+            let mut host = Host::new(&engine, &pre, &options)?;
+            let return_type = if function == "is_null" {
+                vec![BOOLEAN]
+            } else {
+                benchmark.descriptor.clone()
+            };
+            host.setup(function, &argument_type(&benchmark.descriptor), &return_type)?;
+
+            let row = record(&benchmark.value);
+            let single = host.write(&row)?;
+            let batch = host.write(&row.repeat(options.rows as usize))?;
+
+            let execute = measure(options.duration, 1, || {
+                let result = host.execute.call(&mut host.store, single)?;
+                if result == 0 {
+                    bail!("execute failed");
+                }
+                host.deallocate.call(&mut host.store, result)?;
+                Ok(())
+            })?;
+            let rows = options.rows;
+            let execute_batch = measure(options.duration, rows as u64, || {
+                let result = host.execute_batch.call(&mut host.store, (rows, batch))?;
+                if result == 0 {
+                    bail!("execute_batch failed");
+                }
+                let mut size = [0u8; 4];
+                host.memory.read(&host.store, result as usize, &mut size)?;
+                if i32::from_le_bytes(size) == 0 {
+                    bail!("execute_batch failed");
+                }
+                Ok(())
+            })?;
+            println!(
+                "{:<44} {:<10} {:>14.1} {:>14.1}",
+                benchmark.name, function, execute, execute_batch
+            );
+        }
+    }
+    Ok(())
+}
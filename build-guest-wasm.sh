@@ -0,0 +1,30 @@
+#!/usr/bin/env bash
+
+set -eu -o pipefail
+
+GUEST_DIR=$1
+FUNCTIONS=$2
+OUTPUT_NAME=$3
+
+WIZER="${WIZER:-/usr/local/bin/wizer}"
+VARIANT="${VARIANT:-}"
+
+TARGET_DIR=target/wasm${VARIANT:+-${VARIANT}}
+
+if [[ ! -f ${TARGET_DIR}/python-host-opt.wasm ]]; then
+    echo "${TARGET_DIR}/python-host-opt.wasm not found, run build-wasm.sh first" >&2
+    exit 1
+fi
+
+# second stage snapshot: import the guest module on top of the initialized
+# interpreter, so instances start with the module and its imports loaded
+env - TERM=dumb PYTHONDONTWRITEBYTECODE=1 TRINO_GUEST_FUNCTIONS="${FUNCTIONS}" ${WIZER} \
+    --wasm-bulk-memory true \
+    --allow-wasi \
+    --inherit-stdio true \
+    --inherit-env true \
+    --init-func initialize_guest \
+    --keep-init-func false \
+    --mapdir /guest::${GUEST_DIR} \
+    -o ${TARGET_DIR}/${OUTPUT_NAME}.wasm \
+    ${TARGET_DIR}/python-host-opt.wasm
@@ -0,0 +1,16 @@
+#!/usr/bin/env bash
+
+set -eu
+
+if [[ $# -ne 3 ]]; then
+    echo "Usage: $0 <guest directory> <function>[,<function>...] <output name>" >&2
+    exit 1
+fi
+
+GUEST_DIR=$(realpath "$1")
+cd "${BASH_SOURCE%/*}"
+
+BUILD_IMAGE=${BUILD_IMAGE:-trinodb/wasm-python}
+
+docker run -t -e VARIANT -v"$PWD":/work -v"$GUEST_DIR":/guest-source:ro -w /work $BUILD_IMAGE \
+    ./build-guest-wasm.sh /guest-source "$2" "$3"
@@ -7,26 +7,50 @@ BUILD_TYPE=$([[ "${1:-}" == "--debug" ]] && echo "Debug" || echo "Release")
 WASI_SDK_PATH="${WASI_SDK_PATH:-/opt/wasi-sdk}"
 WIZER="${WIZER:-/usr/local/bin/wizer}"
 PYTHON_PATH="${PYTHON_PATH:-/opt/wasi-python}"
+BUILD_PYTHON="${BUILD_PYTHON:-/build/cpython/cross-build/build/python}"
 
-TARGET_DIR=target/wasm
+# freeze the modules the host always imports and pack the rest of the
+# standard library as a bytecode only zip archive
+FROZEN_MODULES="${FROZEN_MODULES:-OFF}"
+
+# maximum linear memory in bytes; artifacts with other limits are built as
+# named variants into their own target directory
+MAX_MEMORY="${MAX_MEMORY:-67108864}"
+VARIANT="${VARIANT:-}"
+
+TARGET_DIR=target/wasm${VARIANT:+-${VARIANT}}
 
 export CMAKE_EXTRA_ARGS="
     -DCMAKE_BUILD_TYPE=${BUILD_TYPE}
     -DWASI_SDK_PREFIX=${WASI_SDK_PATH}
     -DCMAKE_TOOLCHAIN_FILE=${WASI_SDK_PATH}/share/cmake/wasi-sdk.cmake
-    -DCMAKE_PREFIX_PATH=/opt/wasi-python"
+    -DCMAKE_PREFIX_PATH=/opt/wasi-python
+    -DPYHOST_FROZEN_MODULES=${FROZEN_MODULES}
+    -DPYHOST_MAX_MEMORY=${MAX_MEMORY}
+    -DPYHOST_FREEZE_PYTHON=${BUILD_PYTHON}
+    -DPYHOST_FREEZE_STDLIB=${PYTHON_PATH}/lib/python3.13"
 
 cmake -B ${TARGET_DIR} ${CMAKE_EXTRA_ARGS} .
 cmake --build ${TARGET_DIR} --verbose
 
-rm -rf "${TARGET_DIR}"/python
+rm -rf "${TARGET_DIR}"/python "${TARGET_DIR}"/lib
+
+if [[ "${FROZEN_MODULES}" == "ON" ]]; then
+    mkdir ${TARGET_DIR}/lib
+    cp -a ${PYTHON_PATH}/lib/python3.13 ${TARGET_DIR}/lib/python3.13
+    ${BUILD_PYTHON} pack-stdlib.py --output ${TARGET_DIR}/lib/python313.zip ${TARGET_DIR}/lib/python3.13
 
-cp -a ${PYTHON_PATH}/lib/python3.13 ${TARGET_DIR}/python
-cp /work/trino.py ${TARGET_DIR}/python/site-packages/
+    wasi-vfs pack ${TARGET_DIR}/python-host.wasm \
+        --dir ${TARGET_DIR}/lib::/opt/wasi-python/lib \
+        --output ${TARGET_DIR}/python-host-packed.wasm
+else
+    cp -a ${PYTHON_PATH}/lib/python3.13 ${TARGET_DIR}/python
+    cp /work/trino.py ${TARGET_DIR}/python/site-packages/
 
-wasi-vfs pack ${TARGET_DIR}/python-host.wasm \
-    --dir ${TARGET_DIR}/python::/opt/wasi-python/lib/python3.13 \
-    --output ${TARGET_DIR}/python-host-packed.wasm
+    wasi-vfs pack ${TARGET_DIR}/python-host.wasm \
+        --dir ${TARGET_DIR}/python::/opt/wasi-python/lib/python3.13 \
+        --output ${TARGET_DIR}/python-host-packed.wasm
+fi
 
 rm -rf "${TARGET_DIR}"/empty
 mkdir ${TARGET_DIR}/empty
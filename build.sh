@@ -5,4 +5,4 @@ cd "${BASH_SOURCE%/*}"
 
 BUILD_IMAGE=${BUILD_IMAGE:-trinodb/wasm-python}
 
-docker run -t -v"$PWD":/work -w /work $BUILD_IMAGE ./build-wasm.sh "$@"
+docker run -t -e FROZEN_MODULES -e MAX_MEMORY -e VARIANT -v"$PWD":/work -w /work $BUILD_IMAGE ./build-wasm.sh "$@"
@@ -0,0 +1,62 @@
+#!/usr/bin/env python3
+#
+# Generates a C file with marshalled code objects for the given modules,
+# for use as PyImport_FrozenModules. It must be run by a Python of the same
+# version as the one being embedded, as the bytecode format is not stable.
+
+import argparse
+import marshal
+import os
+import sys
+
+
+def find_module(name, paths):
+    relative = os.path.join(*name.split('.'))
+    for path in paths:
+        module = os.path.join(path, relative + '.py')
+        if os.path.isfile(module):
+            return module, False
+        package = os.path.join(path, relative, '__init__.py')
+        if os.path.isfile(package):
+            return package, True
+    raise SystemExit(f'Cannot find module {name} in {os.pathsep.join(paths)}')
+
+
+def c_identifier(name):
+    return 'frozen_' + name.replace('.', '_')
+
+
+def write_array(out, identifier, data):
+    out.write(f'static const unsigned char {identifier}[] = {{\n')
+    for i in range(0, len(data), 16):
+        out.write('    ' + ', '.join(str(b) for b in data[i:i + 16]) + ',\n')
+    out.write('};\n\n')
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Freeze Python modules into a C source file')
+    parser.add_argument('--path', action='append', required=True, help='module search directory')
+    parser.add_argument('--output', required=True, help='generated C file')
+    parser.add_argument('modules', nargs='+', help='module names to freeze')
+    args = parser.parse_args()
+
+    entries = []
+    with open(args.output, 'w') as out:
+        out.write(f'// Generated by {os.path.basename(sys.argv[0])}, do not edit\n\n')
+        out.write('#define PY_SSIZE_T_CLEAN\n#include <Python.h>\n\n')
+        for name in args.modules:
+            filename, is_package = find_module(name, args.path)
+            with open(filename, 'rb') as source:
+                code = compile(source.read(), f'<frozen {name}>', 'exec', dont_inherit=True)
+            identifier = c_identifier(name)
+            write_array(out, identifier, marshal.dumps(code))
+            entries.append((name, identifier, is_package))
+
+        out.write('const struct _frozen pyhostFrozenModules[] = {\n')
+        for name, identifier, is_package in entries:
+            out.write(f'    {{"{name}", {identifier}, (int)sizeof({identifier}), {int(is_package)}}},\n')
+        out.write('    {0, 0, 0, 0},\n};\n')
+
+
+if __name__ == '__main__':
+    main()
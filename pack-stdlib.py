@@ -0,0 +1,33 @@
+#!/usr/bin/env python3
+#
+# Moves the compiled standard library into a bytecode only zip archive, which
+# the interpreter finds on its default path as lib/python313.zip. Sources are
+# removed, and site-packages is left in place.
+
+import argparse
+import os
+import zipfile
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Pack the compiled standard library into a zip archive')
+    parser.add_argument('--output', required=True, help='zip archive to create')
+    parser.add_argument('library', help='lib/python3.13 directory compiled with compileall -b')
+    args = parser.parse_args()
+
+    with zipfile.ZipFile(args.output, 'w', zipfile.ZIP_DEFLATED) as archive:
+        for root, dirs, files in os.walk(args.library):
+            if root == args.library:
+                dirs.remove('site-packages')
+            dirs.sort()
+            for file in sorted(files):
+                path = os.path.join(root, file)
+                if file.endswith('.pyc'):
+                    archive.write(path, os.path.relpath(path, args.library))
+                    os.remove(path)
+                elif file.endswith('.py') and os.path.isfile(path + 'c'):
+                    os.remove(path)
+
+
+if __name__ == '__main__':
+    main()
@@ -2,6 +2,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 #define PY_SSIZE_T_CLEAN
 #include <Python.h>
@@ -11,6 +12,15 @@
 
 const static i64 MICROSECONDS = 1000 * 1000;
 
+#ifndef PYHOST_MAX_MEMORY
+#define PYHOST_MAX_MEMORY (64 * 1024 * 1024)
+#endif
+
+#define MAX_DECIMAL_PRECISION 38
+#define MAX_SHORT_DECIMAL_PRECISION 18
+
+typedef __int128 i128;
+
 #ifdef NDEBUG
 #define DEBUG(format, ...)
 #else
@@ -18,20 +28,48 @@ const static i64 MICROSECONDS = 1000 * 1000;
     fprintf(stdout, format "\n" __VA_OPT__(, ) __VA_ARGS__)
 #endif
 
-static PyObject* emptyTuple;
+#ifdef PYHOST_FROZEN_MODULES
+// generated by freeze-modules.py
+extern const struct _frozen pyhostFrozenModules[];
+#endif
+
+// Objects and layouts the host resolves once in main. They are captured in the
+// snapshot and only read afterwards, so they are the same in every instance
+// started from it. The mutable state of an instance is grouped by lifetime:
+// the function registry, the call in progress, tracebacks, the active stream,
+// the profiler, stats, and scratch buffers.
+typedef struct
+{
+    PyObject* emptyTuple;
+
+    PyObject* decimalClass;
+    PyObject* decimalContext;
+    PyObject* uuidClass;
+    PyObject* ipaddressV4Class;
+    PyObject* ipaddressV6Class;
+
+    PyObject* trinoErrorClass;
+    PyObject* formatTracebackFunction;
+    PyObject* decimalToStringFunction;
+    PyObject* numberToStringFunction;
+    PyObject* openChunkedFunction;
 
-static PyObject* decimalClass;
-static PyObject* uuidClass;
-static PyObject* ipaddressV4Class;
-static PyObject* ipaddressV6Class;
+    // subclasses defined by the trino module that add the collections.abc mixin methods
+    PyTypeObject* lazyMapClass;
+    PyTypeObject* lazyArrayClass;
+    PyTypeObject* lazyRowClass;
 
-static PyObject* trinoErrorResultFunction;
-static PyObject* decimalToStringFunction;
-static PyObject* numberToStringFunction;
-static PyObject* guestFunction;
+    // UUID and ipaddress objects are built and read through the offsets of their
+    // __slots__ members, skipping the constructors, validation and properties
+    Py_ssize_t uuidIntOffset;
+    Py_ssize_t uuidIsSafeOffset;
+    Py_ssize_t ipv4IpOffset;
+    Py_ssize_t ipv6IpOffset;
+    Py_ssize_t ipv6ScopeIdOffset;
+    PyObject* uuidSafeUnknown;
+} HostContext;
 
-static const u8* trinoArgType;
-static const u8* trinoReturnType;
+static HostContext host;
 
 static PyObject* loadModule(const char* name);
 static PyObject* findFunction(PyObject* module, const char* name);
@@ -101,308 +139,52 @@ static i64 readI64(const u8** const data)
     return value;
 }
 
-static PyObject* readString(const u8** const data)
-{
-    const i32 size = readI32(data);
-    PyObject* value = checked(PyUnicode_FromStringAndSize((const char*)*data, size));
-    *data += size;
-    return value;
-}
+static HostStats stats = {
+    .version = HOST_STATS_VERSION,
+    .typeCount = TRINO_TYPE_COUNT,
+};
 
-// skip type at the current position in the type descriptor
-static void skipType(const u8** const type)
+static i64 clockNanos()
 {
-    const TrinoType trinoType = readI32(type);
-    DEBUG("skipType: type=%d", trinoType);
-
-    switch (trinoType) {
-        case ROW: {
-            const i32 count = readI32(type);
-            for (i32 i = 0; i < count; i++) {
-                skipType(type);
-            }
-            break;
-        }
-        case ARRAY:
-            skipType(type);
-            break;
-        case MAP:
-            skipType(type);
-            skipType(type);
-            break;
-        case BOOLEAN:
-        case BIGINT:
-        case INTEGER:
-        case SMALLINT:
-        case TINYINT:
-        case DOUBLE:
-        case REAL:
-        case DECIMAL:
-        case NUMBER:
-        case VARCHAR:
-        case VARBINARY:
-        case DATE:
-        case TIME:
-        case TIME_WITH_TIME_ZONE:
-        case TIMESTAMP:
-        case TIMESTAMP_WITH_TIME_ZONE:
-        case INTERVAL_YEAR_TO_MONTH:
-        case INTERVAL_DAY_TO_SECOND:
-        case JSON:
-        case UUID:
-        case IPADDRESS:
-            break;
-        default:
-            FATAL("Unsupported Trino type %d", trinoType);
-    }
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (i64)now.tv_sec * 1000 * 1000 * 1000 + now.tv_nsec;
 }
 
-static PyObject* doBuildArgs(const u8** const type, const u8** const data)
+static void phaseEnd(PhaseStats* phase, const i64 start)
 {
-    const bool present = readI8(data);
-    if (!present) {
-        DEBUG("buildArgs: present=false");
-        skipType(type);
-        return Py_None;
-    }
-
-    const TrinoType trinoType = readI32(type);
-    DEBUG("buildArgs: type=%d", trinoType);
-
-    switch (trinoType) {
-        case ROW: {
-            const i32 count = readI32(type);
-            DEBUG("buildArgs: fieldCount=%d", count);
-            PyObject* tuple = checked(PyTuple_New(count));
-            for (i32 i = 0; i < count; i++) {
-                PyObject* value = doBuildArgs(type, data);
-                PyTuple_SET_ITEM(tuple, i, value);
-            }
-            return tuple;
-        }
-        case ARRAY: {
-            const u8* savedType = *type;
-            const i32 count = readI32(data);
-            DEBUG("buildArgs: elementCount=%d", count);
-            PyObject* list = checked(PyList_New(count));
-            for (i32 i = 0; i < count; i++) {
-                *type = savedType;
-                PyObject* value = doBuildArgs(type, data);
-                PyList_SET_ITEM(list, i, value);
-            }
-            if (count == 0) {
-                skipType(type);
-            }
-            return list;
-        }
-        case MAP: {
-            const u8* savedType = *type;
-            const i32 count = readI32(data);
-            DEBUG("buildArgs: entryCount=%d", count);
-            PyObject* dict = checked(PyDict_New());
-            for (i32 i = 0; i < count; i++) {
-                *type = savedType;
-                PyObject* key = doBuildArgs(type, data);
-                PyObject* value = doBuildArgs(type, data);
-                if (PyDict_SetItem(dict, key, value) == -1) {
-                    PyErr_Print();
-                    FATAL("Failed to set dictionary item");
-                }
-                Py_DECREF(key);
-                Py_DECREF(value);
-            }
-            return dict;
-        }
-        case BOOLEAN: {
-            const bool value = readI8(data);
-            return value ? Py_True : Py_False;
-        }
-        case BIGINT: {
-            const i64 value = readI64(data);
-            return checked(PyLong_FromLongLong(value));
-        }
-        case INTEGER: {
-            const i32 value = readI32(data);
-            return checked(PyLong_FromLong(value));
-        }
-        case SMALLINT: {
-            const i16 value = readI16(data);
-            return checked(PyLong_FromLong(value));
-        }
-        case TINYINT: {
-            const i8 value = readI8(data);
-            return checked(PyLong_FromLong(value));
-        }
-        case DOUBLE: {
-            const f64 value = *(const f64*)*data;
-            *data += sizeof(f64);
-            return checked(PyFloat_FromDouble(value));
-        }
-        case REAL: {
-            const f32 value = *(const f32*)*data;
-            *data += sizeof(f32);
-            return checked(PyFloat_FromDouble(value));
-        }
-        case DECIMAL:
-        case NUMBER: {
-            PyObject* number = readString(data);
-            PyObject* value = checked(PyObject_CallOneArg(decimalClass, number));
-            Py_DECREF(number);
-            return value;
-        }
-        case VARCHAR:
-        case JSON: {
-            return readString(data);
-        }
-        case VARBINARY: {
-            const i32 size = readI32(data);
-            PyObject* value = checked(PyBytes_FromStringAndSize((const char*)*data, size));
-            *data += size;
-            return value;
-        }
-        case DATE: {
-            const i32 days = readI32(data);
-            const time_t time = days * (24 * 60 * 60);
-            const struct tm* t = gmtime(&time);
-            return checked(PyDate_FromDate(t->tm_year + 1900, t->tm_mon + 1, t->tm_mday));
-        }
-        case TIME: {
-            const i64 time = readI64(data);
-            const int hour = time / (60 * 60 * MICROSECONDS);
-            const int minute = time / (60 * MICROSECONDS) % 60;
-            const int second = time / MICROSECONDS % 60;
-            const int usecond = time % MICROSECONDS;
-            return checked(PyTime_FromTime(hour, minute, second, usecond));
-        }
-        case TIME_WITH_TIME_ZONE: {
-            const i64 time = readI64(data);
-            const i16 offset = readI16(data);
-            const int hour = time / (60 * 60 * MICROSECONDS);
-            const int minute = time / (60 * MICROSECONDS) % 60;
-            const int second = time / MICROSECONDS % 60;
-            const int usecond = time % MICROSECONDS;
-            PyObject* delta = checked(PyDelta_FromDSU(0, offset * 60, 0));
-            PyObject* tz = checked(PyTimeZone_FromOffset(delta));
-            return checked(PyDateTimeAPI->Time_FromTime(
-                hour, minute, second, usecond, tz, PyDateTimeAPI->TimeType));
-        }
-        case TIMESTAMP: {
-            const i64 ts = readI64(data);
-            const time_t time = ts / MICROSECONDS;
-            const struct tm* t = gmtime(&time);
-            const int year = t->tm_year + 1900;
-            const int month = t->tm_mon + 1;
-            const int day = t->tm_mday;
-            const int hour = t->tm_hour;
-            const int minute = t->tm_min;
-            const int second = t->tm_sec;
-            const int usecond = ts % MICROSECONDS;
-            return checked(PyDateTime_FromDateAndTime(year, month, day, hour, minute, second, usecond));
-        }
-        case TIMESTAMP_WITH_TIME_ZONE: {
-            const i64 ts = readI64(data);
-            const i16 offset = readI16(data);
-            const time_t time = ts / MICROSECONDS + offset * 60;
-            const struct tm* t = gmtime(&time);
-            const int year = t->tm_year + 1900;
-            const int month = t->tm_mon + 1;
-            const int day = t->tm_mday;
-            const int hour = t->tm_hour;
-            const int minute = t->tm_min;
-            const int second = t->tm_sec;
-            const int usecond = ts % MICROSECONDS;
-            PyObject* delta = checked(PyDelta_FromDSU(0, offset * 60, 0));
-            PyObject* tz = checked(PyTimeZone_FromOffset(delta));
-            return checked(PyDateTimeAPI->DateTime_FromDateAndTime(
-                year, month, day, hour, minute, second, usecond, tz, PyDateTimeAPI->DateTimeType));
-        }
-        case INTERVAL_YEAR_TO_MONTH: {
-            const i32 months = readI32(data);
-            return checked(PyLong_FromLong(months));
-        }
-        case INTERVAL_DAY_TO_SECOND: {
-            const i64 millis = readI64(data);
-            const int days = millis / (24 * 60 * 60 * 1000);
-            const int seconds = (millis / 1000) % (24 * 60 * 60);
-            const int micros = (millis % 1000) * 1000;
-            return checked(PyDelta_FromDSU(days, seconds, micros));
-        }
-        case UUID: {
-            PyObject* bytes = checked(PyBytes_FromStringAndSize((const char*)*data, 16));
-            *data += 16;
-            PyObject* kwArgs = checked(PyDict_New());
-            if (PyDict_SetItemString(kwArgs, "bytes", bytes) == -1) {
-                PyErr_Print();
-                FATAL("Failed to set dictionary item");
-            }
-            PyObject* value = checked(PyObject_Call(uuidClass, emptyTuple, kwArgs));
-            Py_DECREF(kwArgs);
-            Py_DECREF(bytes);
-            return value;
-        }
-        case IPADDRESS: {
-            const u32* raw = (u32*)*data;
-            PyObject* bytes;
-            PyObject* value;
-            if (raw[0] == 0x00000000 && raw[1] == 0x00000000 && raw[2] == 0xFFFF0000) {
-                bytes = checked(PyBytes_FromStringAndSize((const char*)(*data + 12), 4));
-                value = checked(PyObject_CallOneArg(ipaddressV4Class, bytes));
-            }
-            else {
-                bytes = checked(PyBytes_FromStringAndSize((const char*)*data, 16));
-                value = checked(PyObject_CallOneArg(ipaddressV6Class, bytes));
-            }
-            *data += 16;
-            Py_DECREF(bytes);
-            return value;
-        }
-    }
-    FATAL("Unsupported Trino type %d", trinoType);
+    phase->count++;
+    phase->nanos += clockNanos() - start;
 }
 
-static PyObject* buildArgs(const u8* data)
+// Per-row phases only take the clock for one in PHASE_SAMPLE_INTERVAL
+// occurrences, since every clock read is a host call, and scale the sample.
+#define PHASE_SAMPLE_INTERVAL 64
+#define PHASE_UNTIMED -1
+
+static i64 phaseSample(const PhaseStats* phase)
 {
-    const u8* type = trinoArgType;
-    return doBuildArgs(&type, &data);
+    return phase->count % PHASE_SAMPLE_INTERVAL == 0 ? clockNanos() : PHASE_UNTIMED;
 }
 
-static void resultError(PyObject* resultValue, const char* trinoType)
+// returns the estimated time of the phase, which is zero when not sampled
+static i64 phaseSampleEnd(PhaseStats* phase, const i64 start)
 {
-    char* message;
-    asprintf(&message, "Failed to convert Python result type '%s' to Trino type %s",
-             Py_TYPE(resultValue)->tp_name, trinoType);
-    if (message == NULL) {
-        FATAL("Failed to allocate memory for error message");
+    phase->count++;
+    if (start == PHASE_UNTIMED) {
+        return 0;
     }
+    const i64 nanos = (clockNanos() - start) * PHASE_SAMPLE_INTERVAL;
+    phase->nanos += nanos;
+    return nanos;
+}
 
-    PyObject* exception = PyErr_GetRaisedException();
-    if (exception == NULL) {
-        FATAL("Python exception not raised for value conversion failure: %s", message);
-    }
-
-    PyObject* exceptionStr = PyObject_Str(exception);
-    if (exceptionStr == NULL) {
-        FATAL("Failed to convert Python exception to string");
-    }
-
-    const char* string = PyUnicode_AsUTF8(exceptionStr);
-    if (string == NULL) {
-        FATAL("Failed to get Python exception string");
-    }
-
-    char* error;
-    asprintf(&error, "%s: %s: %s", message, Py_TYPE(exception)->tp_name, string);
-    if (error == NULL) {
-        FATAL("Failed to allocate memory for error message");
-    }
-    free(message);
-
-    Py_DECREF(exceptionStr);
-    Py_DECREF(exception);
-
-    trinoReturnError(FUNCTION_IMPLEMENTATION_ERROR, (u8*)error, strlen(error), NULL, 0);
-
-    free(error);
+static PyObject* readString(const u8** const data)
+{
+    const i32 size = readI32(data);
+    PyObject* value = checked(PyUnicode_FromStringAndSize((const char*)*data, size));
+    *data += size;
+    return value;
 }
 
 typedef struct
@@ -412,13 +194,31 @@ typedef struct
     i32 used;
 } Buffer;
 
+typedef struct GuestFunction GuestFunction;
+
+// State of the call in progress. Every entry point selects the function and
+// releases the argument views and streams before it returns.
+typedef struct
+{
+    GuestFunction* guest; // function of the current call
+    Buffer* errorBuffer; // when set, errors are recorded here instead of being returned to Trino
+    PyObject* argumentViews; // memoryviews over the argument data
+    PyObject* argumentStreams; // files of chunked arguments
+} CallContext;
+
+static CallContext call;
+
+#define BUFFER_MIN_SIZE 64
+
 static void bufferReserve(Buffer* buffer, const i32 required)
 {
     if (buffer->size < required) {
-        do {
-            buffer->size *= 2;
+        // double, or grow to the exact size for large reservations made up front
+        i32 size = buffer->size > 0 ? buffer->size * 2 : BUFFER_MIN_SIZE;
+        if (size < required) {
+            size = required;
         }
-        while (buffer->size < required);
+        buffer->size = size;
         buffer->data = xrealloc(buffer->data, buffer->size);
     }
 }
@@ -462,520 +262,4291 @@ static bool bufferAppendString(Buffer* buffer, PyObject* object)
     return true;
 }
 
+static void returnError(
+    const i32 errorCode, const char* message, const i32 messageSize, const char* traceback, const i32 tracebackSize)
+{
+    if (call.errorBuffer == NULL) {
+        trinoReturnError(errorCode, (u8*)message, messageSize, (u8*)traceback, tracebackSize);
+        return;
+    }
+    bufferAppendI32(call.errorBuffer, errorCode);
+    bufferAppendI32(call.errorBuffer, messageSize);
+    bufferAppend(call.errorBuffer, (u8*)message, messageSize);
+    bufferAppendI32(call.errorBuffer, tracebackSize);
+    bufferAppend(call.errorBuffer, (u8*)traceback, tracebackSize);
+}
+
+// composed error messages are formatted into a static buffer, truncated at a
+// character boundary, so that failing rows do not allocate
+static char errorMessage[4096];
+
+__attribute__((format(printf, 1, 2))) static i32 formatErrorMessage(const char* format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    i32 size = vsnprintf(errorMessage, sizeof(errorMessage), format, args);
+    va_end(args);
+    if (size < 0) {
+        FATAL("Failed to format error message");
+    }
+    if (size >= (i32)sizeof(errorMessage)) {
+        size = sizeof(errorMessage) - 1;
+        while (size > 0 && (errorMessage[size] & 0xC0) == 0x80) {
+            size--;
+        }
+    }
+    return size;
+}
+
+static void resultError(PyObject* resultValue, const char* trinoType)
+{
+    const i64 start = clockNanos();
+    PyObject* exception = PyErr_GetRaisedException();
+    if (exception == NULL) {
+        FATAL("Python exception not raised for value conversion failure to %s", trinoType);
+    }
+
+    PyObject* exceptionStr = PyObject_Str(exception);
+    if (exceptionStr == NULL) {
+        FATAL("Failed to convert Python exception to string");
+    }
+
+    const char* string = PyUnicode_AsUTF8(exceptionStr);
+    if (string == NULL) {
+        FATAL("Failed to get Python exception string");
+    }
+
+    const i32 size = formatErrorMessage("Failed to convert Python result type '%s' to Trino type %s: %s: %s",
+        Py_TYPE(resultValue)->tp_name, trinoType, Py_TYPE(exception)->tp_name, string);
+    returnError(FUNCTION_IMPLEMENTATION_ERROR, errorMessage, size, NULL, 0);
+
+    Py_DECREF(exceptionStr);
+    Py_DECREF(exception);
+    phaseEnd(&stats.error, start);
+}
+
 static void overflowError(const char* message)
 {
-    trinoReturnError(NUMERIC_VALUE_OUT_OF_RANGE, (u8*)message, strlen(message), NULL, 0);
+    returnError(NUMERIC_VALUE_OUT_OF_RANGE, message, strlen(message), NULL, 0);
 }
 
 static void memoryError()
 {
-    const char* message = "Python MemoryError (no traceback available)";
-    trinoReturnError(EXCEEDED_FUNCTION_MEMORY_LIMIT, (u8*)message, strlen(message), NULL, 0);
+    const i32 size = formatErrorMessage("Python MemoryError with a memory limit of %d MB (no traceback available)",
+        (int)(PYHOST_MAX_MEMORY / (1024 * 1024)));
+    returnError(EXCEEDED_FUNCTION_MEMORY_LIMIT, errorMessage, size, NULL, 0);
+}
+
+static Py_ssize_t slotOffset(PyObject* type, const char* name)
+{
+    PyObject* descriptor = checked(PyObject_GetAttrString(type, name));
+    if (!Py_IS_TYPE(descriptor, &PyMemberDescr_Type)) {
+        FATAL("Attribute '%s' of '%s' is not a slot", name, _PyType_CAST(type)->tp_name);
+    }
+    const Py_ssize_t offset = ((PyMemberDescrObject*)descriptor)->d_member->offset;
+    Py_DECREF(descriptor);
+    return offset;
+}
+
+static PyObject** slot(PyObject* object, const Py_ssize_t offset)
+{
+    return (PyObject**)((char*)object + offset);
+}
+
+static PyObject* newSlotObject(PyObject* type)
+{
+    return checked(_PyType_CAST(type)->tp_alloc(_PyType_CAST(type), 0));
 }
 
-static bool appendBytesAttr(PyObject* input, Buffer* buffer, const char* attr, const char* trinoType)
+// appends an int slot as an unsigned big-endian integer of the given size
+static bool appendIntSlot(PyObject* input, const Py_ssize_t offset, const i32 size, Buffer* buffer, const char* trinoType)
 {
-    PyObject* bytes = PyObject_GetAttrString(input, attr);
-    if (bytes == NULL) {
+    PyObject* value = *slot(input, offset);
+    if (value == NULL || !PyLong_Check(value)) {
+        PyErr_Format(PyExc_TypeError, "'%s' object has no integer value", Py_TYPE(input)->tp_name);
         resultError(input, trinoType);
         return false;
     }
-    Py_ssize_t size;
-    char* data;
-    if (PyBytes_AsStringAndSize(bytes, &data, &size) == -1) {
-        Py_DECREF(bytes);
+    u8 bytes[16];
+    const Py_ssize_t required = PyLong_AsNativeBytes(value, bytes, size,
+        Py_ASNATIVEBYTES_BIG_ENDIAN | Py_ASNATIVEBYTES_UNSIGNED_BUFFER | Py_ASNATIVEBYTES_REJECT_NEGATIVE);
+    if (required > size) {
+        PyErr_Format(PyExc_OverflowError, "integer value does not fit in %d bytes", size);
+    }
+    if (required < 0 || required > size) {
         resultError(input, trinoType);
         return false;
     }
-    bufferAppend(buffer, (u8*)data, size);
-    Py_DECREF(bytes);
+    bufferAppend(buffer, bytes, size);
     return true;
 }
 
-static bool buildResult(const u8** const type, PyObject* input, Buffer* buffer)
+typedef struct TypeNode TypeNode;
+
+typedef PyObject* (*Decoder)(const TypeNode* node, const u8** data);
+typedef bool (*Encoder)(const TypeNode* node, PyObject* input, Buffer* buffer);
+
+// Compiled type descriptor node. The nodes of a type are stored in pre-order,
+// so the first child of a node directly follows it and the next sibling of a
+// child is found by skipping over its subtree.
+struct TypeNode
 {
-    bool present = input != Py_None;
-    bufferAppendI8(buffer, present);
+    TrinoType type;
+    i32 width; // fixed byte width of the value, or zero
+    i32 count; // field count for ROW
+    i32 precision; // for UNSCALED_DECIMAL
+    i32 scale; // for UNSCALED_DECIMAL
+    i32 size; // node count of the subtree including this node
+    Decoder decode;
+    Encoder encode;
+};
+
+typedef struct
+{
+    TypeNode* nodes;
+    i32 count;
+    i32 capacity;
+} TypePlan;
+
+static const TypeNode* nextSibling(const TypeNode* node)
+{
+    return node + node->size;
+}
+
+// byte width of a value in the columnar encoding, or zero if variable width
+static i32 fixedWidth(const TrinoType trinoType)
+{
+    switch (trinoType) {
+        case BOOLEAN:
+        case TINYINT:
+            return 1;
+        case SMALLINT:
+            return 2;
+        case INTEGER:
+        case REAL:
+        case DATE:
+        case INTERVAL_YEAR_TO_MONTH:
+            return 4;
+        case BIGINT:
+        case DOUBLE:
+        case TIME:
+        case TIMESTAMP:
+        case INTERVAL_DAY_TO_SECOND:
+            return 8;
+        case TIME_WITH_TIME_ZONE:
+        case TIMESTAMP_WITH_TIME_ZONE:
+            return 10;
+        case UUID:
+        case IPADDRESS:
+            return 16;
+        default:
+            return 0;
+    }
+}
+
+// variable width types stored in the columnar encoding without a length prefix
+static bool isRawBytes(const TrinoType trinoType)
+{
+    return trinoType == VARCHAR || trinoType == JSON || trinoType == VARBINARY ||
+           trinoType == DECIMAL || trinoType == NUMBER;
+}
+
+static PyObject* decodeField(const TypeNode* node, const u8** const data)
+{
+    const bool present = readI8(data);
     if (!present) {
-        DEBUG("buildResult: present=false");
-        skipType(type);
-        return true;
+        DEBUG("buildArgs: present=false");
+        return Py_None;
     }
+    DEBUG("buildArgs: type=%d", node->type);
+    stats.decodedValues[node->type]++;
+    return node->decode(node, data);
+}
 
-    const TrinoType trinoType = readI32(type);
-    DEBUG("buildResult: type=%d", trinoType);
+static PyObject* decodeRow(const TypeNode* node, const u8** const data)
+{
+    DEBUG("buildArgs: fieldCount=%d", node->count);
+    PyObject* tuple = checked(PyTuple_New(node->count));
+    const TypeNode* field = node + 1;
+    for (i32 i = 0; i < node->count; i++) {
+        PyObject* value = decodeField(field, data);
+        PyTuple_SET_ITEM(tuple, i, value);
+        field = nextSibling(field);
+    }
+    return tuple;
+}
 
-    switch (trinoType) {
-        case ROW: {
-            if (!checkType(input, &PyTuple_Type)) {
-                resultError(input, "ROW");
-                return false;
-            }
-            const i32 count = readI32(type);
-            if (PyTuple_Size(input) != count) {
-                PyErr_Format(PyExc_ValueError, "tuple has %d fields, expected %d fields for row",
-                             PyTuple_Size(input), count);
-                resultError(input, "ROW");
-                return false;
-            }
-            for (i32 i = 0; i < count; i++) {
-                if (!buildResult(type, PyTuple_GetItem(input, i), buffer)) {
-                    return false;
-                }
-            }
-            return true;
-        }
-        case ARRAY: {
-            if (!checkType(input, &PyList_Type)) {
-                resultError(input, "ARRAY");
-                return false;
-            }
-            const u8* savedType = *type;
-            const i32 size = PyList_Size(input);
-            bufferAppendI32(buffer, size);
-            for (i32 i = 0; i < size; i++) {
-                *type = savedType;
-                if (!buildResult(type, PyList_GetItem(input, i), buffer)) {
-                    return false;
-                }
-            }
-            return true;
-        }
-        case MAP: {
-            if (!checkType(input, &PyDict_Type)) {
-                resultError(input, "MAP");
-                return false;
-            }
-            const u8* savedType = *type;
-            const i32 size = PyDict_Size(input);
-            bufferAppendI32(buffer, size);
-            PyObject* key;
-            PyObject* value;
-            Py_ssize_t pos = 0;
-            while (PyDict_Next(input, &pos, &key, &value)) {
-                *type = savedType;
-                if (!buildResult(type, key, buffer)) {
-                    return false;
-                }
-                if (!buildResult(type, value, buffer)) {
-                    return false;
-                }
-            }
-            return true;
+static PyObject* decodeArray(const TypeNode* node, const u8** const data)
+{
+    const TypeNode* element = node + 1;
+    const i32 count = readI32(data);
+    DEBUG("buildArgs: elementCount=%d", count);
+    PyObject* list = checked(PyList_New(count));
+    for (i32 i = 0; i < count; i++) {
+        PyObject* value = decodeField(element, data);
+        PyList_SET_ITEM(list, i, value);
+    }
+    return list;
+}
+
+static PyObject* decodeMap(const TypeNode* node, const u8** const data)
+{
+    const TypeNode* keyNode = node + 1;
+    const TypeNode* valueNode = nextSibling(keyNode);
+    const i32 count = readI32(data);
+    DEBUG("buildArgs: entryCount=%d", count);
+    // keys are unique, so the table never resizes while it is filled
+    PyObject* dict = checked(_PyDict_NewPresized(count));
+    for (i32 i = 0; i < count; i++) {
+        PyObject* key = decodeField(keyNode, data);
+        PyObject* value = decodeField(valueNode, data);
+        if (PyDict_SetItem(dict, key, value) == -1) {
+            PyErr_Print();
+            FATAL("Failed to set dictionary item");
         }
-        case BOOLEAN: {
-            int value = PyObject_IsTrue(input);
-            if (value == -1) {
-                resultError(input, "BOOLEAN");
-                return false;
-            }
-            bufferAppendI8(buffer, value);
-            return true;
+        Py_DECREF(key);
+        Py_DECREF(value);
+    }
+    return dict;
+}
+
+static PyObject* decodeBoolean(const TypeNode* node, const u8** const data)
+{
+    (void)node;
+    const bool value = readI8(data);
+    return value ? Py_True : Py_False;
+}
+
+static PyObject* decodeBigint(const TypeNode* node, const u8** const data)
+{
+    (void)node;
+    const i64 value = readI64(data);
+    return checked(PyLong_FromLongLong(value));
+}
+
+static PyObject* decodeInteger(const TypeNode* node, const u8** const data)
+{
+    (void)node;
+    const i32 value = readI32(data);
+    return checked(PyLong_FromLong(value));
+}
+
+static PyObject* decodeSmallint(const TypeNode* node, const u8** const data)
+{
+    (void)node;
+    const i16 value = readI16(data);
+    return checked(PyLong_FromLong(value));
+}
+
+static PyObject* decodeTinyint(const TypeNode* node, const u8** const data)
+{
+    (void)node;
+    const i8 value = readI8(data);
+    return checked(PyLong_FromLong(value));
+}
+
+static PyObject* decodeDouble(const TypeNode* node, const u8** const data)
+{
+    (void)node;
+    const f64 value = *(const f64*)*data;
+    *data += sizeof(f64);
+    return checked(PyFloat_FromDouble(value));
+}
+
+static PyObject* decodeReal(const TypeNode* node, const u8** const data)
+{
+    (void)node;
+    const f32 value = *(const f32*)*data;
+    *data += sizeof(f32);
+    return checked(PyFloat_FromDouble(value));
+}
+
+static PyObject* decodeDecimal(const TypeNode* node, const u8** const data)
+{
+    (void)node;
+    PyObject* number = readString(data);
+    PyObject* value = checked(PyObject_CallOneArg(host.decimalClass, number));
+    Py_DECREF(number);
+    return value;
+}
+
+// the unscaled value is a little-endian two's complement integer of the node
+// width; the Decimal constructor is exact for integers and scaleb is exact
+// under the maximum precision context
+static PyObject* decodeUnscaledDecimal(const TypeNode* node, const u8** const data)
+{
+    PyObject* unscaled = checked(PyLong_FromNativeBytes(*data, node->width, Py_ASNATIVEBYTES_LITTLE_ENDIAN));
+    *data += node->width;
+    PyObject* value = checked(PyObject_CallOneArg(host.decimalClass, unscaled));
+    Py_DECREF(unscaled);
+    if (node->scale == 0) {
+        return value;
+    }
+    PyObject* scaled = checked(PyObject_CallMethod(value, "scaleb", "iO", -node->scale, host.decimalContext));
+    Py_DECREF(value);
+    return scaled;
+}
+
+static PyObject* decodeVarchar(const TypeNode* node, const u8** const data)
+{
+    (void)node;
+    return readString(data);
+}
+
+static PyObject* decodeVarbinary(const TypeNode* node, const u8** const data)
+{
+    (void)node;
+    const i32 size = readI32(data);
+    PyObject* value = checked(PyBytes_FromStringAndSize((const char*)*data, size));
+    *data += size;
+    return value;
+}
+
+// memoryview over the argument data, released once the guest returns
+static PyObject* newArgumentView(const char* data, const i32 size)
+{
+    PyObject* view = checked(PyMemoryView_FromMemory((char*)data, size, PyBUF_READ));
+    if (PyList_Append(call.argumentViews, view) == -1) {
+        PyErr_Print();
+        FATAL("Failed to track argument view");
+    }
+    return view;
+}
+
+static PyObject* decodeArgumentView(const TypeNode* node, const u8** const data)
+{
+    (void)node;
+    const i32 size = readI32(data);
+    PyObject* value = newArgumentView((const char*)*data, size);
+    *data += size;
+    return value;
+}
+
+static bool releaseViews(PyObject* views)
+{
+    bool success = true;
+    for (Py_ssize_t i = 0; i < PySequence_Fast_GET_SIZE(views); i++) {
+        PyObject* result = PyObject_CallMethod(PySequence_Fast_GET_ITEM(views, i), "release", NULL);
+        if (result == NULL) {
+            success = false;
+            continue;
+        }
+        Py_DECREF(result);
+    }
+    return success;
+}
+
+// file object reading the value in chunks from Trino, closed once the guest returns
+static PyObject* decodeChunkedArgument(const TypeNode* node, const u8** const data)
+{
+    const i32 stream = readI32(data);
+    PyObject* file = checked(PyObject_CallFunction(
+        host.openChunkedFunction, "iO", stream, node->type == VARCHAR ? Py_True : Py_False));
+    if (PyList_Append(call.argumentStreams, file) == -1) {
+        PyErr_Print();
+        FATAL("Failed to track argument stream");
+    }
+    return file;
+}
+
+static void clearList(PyObject* list)
+{
+    if (PyList_SetSlice(list, 0, PY_SSIZE_T_MAX, NULL) == -1) {
+        PyErr_Print();
+        FATAL("Failed to clear argument list");
+    }
+}
+
+static void closeStreams(PyObject* streams)
+{
+    for (Py_ssize_t i = 0; i < PyList_GET_SIZE(streams); i++) {
+        PyObject* result = PyObject_CallMethod(PyList_GET_ITEM(streams, i), "close", NULL);
+        Py_XDECREF(result);
+    }
+    PyErr_Clear();
+    clearList(streams);
+}
+
+// closes the streams and releases the views, returning false if a view
+// could not be released because the guest kept a buffer exported from it
+static bool releaseArguments(PyObject* views, PyObject* streams)
+{
+    if (PyList_GET_SIZE(streams) > 0) {
+        closeStreams(streams);
+    }
+    if (PyList_GET_SIZE(views) == 0) {
+        return true;
+    }
+    const bool success = releaseViews(views);
+    PyErr_Clear();
+    clearList(views);
+    return success;
+}
+
+static bool releaseArgumentViews()
+{
+    return releaseArguments(call.argumentViews, call.argumentStreams);
+}
+
+// moves the views and streams of the current call to lists that outlive it
+static void retainArguments(PyObject* views, PyObject* streams)
+{
+    const struct
+    {
+        PyObject* from;
+        PyObject* to;
+    } moves[] = {{call.argumentViews, views}, {call.argumentStreams, streams}};
+    for (size_t i = 0; i < sizeof(moves) / sizeof(moves[0]); i++) {
+        if (PyList_GET_SIZE(moves[i].from) == 0) {
+            continue;
+        }
+        if (PyList_SetSlice(moves[i].to, PY_SSIZE_T_MAX, PY_SSIZE_T_MAX, moves[i].from) == -1) {
+            PyErr_Print();
+            FATAL("Failed to retain argument list");
+        }
+        clearList(moves[i].from);
+    }
+}
+
+#define MAX_TIME_ZONE_OFFSET (14 * 60)
+
+static PyObject* timeZones[2 * MAX_TIME_ZONE_OFFSET + 1];
+
+// time zone for the offset in minutes, cached for the offsets Trino supports
+static PyObject* timeZone(const i16 offset)
+{
+    const bool cacheable = offset >= -MAX_TIME_ZONE_OFFSET && offset <= MAX_TIME_ZONE_OFFSET;
+    PyObject** cached = cacheable ? &timeZones[offset + MAX_TIME_ZONE_OFFSET] : NULL;
+    if (cached != NULL && *cached != NULL) {
+        return Py_NewRef(*cached);
+    }
+
+    PyObject* delta = checked(PyDelta_FromDSU(0, offset * 60, 0));
+    PyObject* tz = checked(PyTimeZone_FromOffset(delta));
+    Py_DECREF(delta);
+    if (cached != NULL) {
+        *cached = Py_NewRef(tz);
+    }
+    return tz;
+}
+
+#define MICROSECONDS_PER_DAY (24 * 60 * 60 * MICROSECONDS)
+
+typedef struct
+{
+    i32 year;
+    i32 month;
+    i32 day;
+} CivilDate;
+
+// proleptic Gregorian conversions between days since 1970-01-01 and a civil
+// date, using Howard Hinnant's era based algorithms; unlike gmtime/timegm they
+// cover the full Trino range and need no time_t or struct tm
+static CivilDate civilFromDays(const i64 days)
+{
+    const i64 z = days + 719468;
+    const i64 era = (z >= 0 ? z : z - 146096) / 146097;
+    const u32 doe = (u32)(z - era * 146097);
+    const u32 yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+    const u32 doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+    const u32 mp = (5 * doy + 2) / 153;
+    const u32 month = mp < 10 ? mp + 3 : mp - 9;
+    return (CivilDate) {
+        .year = (i32)(yoe + era * 400 + (month <= 2)),
+        .month = (i32)month,
+        .day = (i32)(doy - (153 * mp + 2) / 5 + 1),
+    };
+}
+
+static i64 daysFromCivil(const i32 year, const i32 month, const i32 day)
+{
+    const i64 y = (i64)year - (month <= 2);
+    const i64 era = (y >= 0 ? y : y - 399) / 400;
+    const u32 yoe = (u32)(y - era * 400);
+    const u32 doy = (153 * (u32)(month > 2 ? month - 3 : month + 9) + 2) / 5 + (u32)day - 1;
+    const u32 doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    return era * 146097 + (i64)doe - 719468;
+}
+
+// the loop body has no data dependent branches, so the compiler can
+// vectorize a whole column of conversions
+static void civilFromDaysBatch(const i32* days, const i32 count, CivilDate* const dates)
+{
+    for (i32 i = 0; i < count; i++) {
+        dates[i] = civilFromDays(days[i]);
+    }
+}
+
+static i64 floorDiv(const i64 x, const i64 y)
+{
+    const i64 quotient = x / y;
+    return quotient - ((x % y != 0) & ((x < 0) != (y < 0)));
+}
+
+// direct mapped cache of recent dates, as date columns tend to have few
+// distinct values that repeat across rows
+static struct
+{
+    i32 days;
+    PyObject* date;
+} dateCache[256];
+
+static PyObject* newDate(const i32 days, const CivilDate date)
+{
+    const u32 slot = (u32)days % (sizeof(dateCache) / sizeof(dateCache[0]));
+    if (dateCache[slot].date != NULL && dateCache[slot].days == days) {
+        return Py_NewRef(dateCache[slot].date);
+    }
+
+    PyObject* value = checked(PyDate_FromDate(date.year, date.month, date.day));
+    Py_XSETREF(dateCache[slot].date, Py_NewRef(value));
+    dateCache[slot].days = days;
+    return value;
+}
+
+// time is microseconds into the day and tz is Py_None for local timestamps
+static PyObject* newDateTime(const CivilDate date, const i64 time, PyObject* tz)
+{
+    return checked(PyDateTimeAPI->DateTime_FromDateAndTime(
+        date.year, date.month, date.day,
+        time / (60 * 60 * MICROSECONDS),
+        time / (60 * MICROSECONDS) % 60,
+        time / MICROSECONDS % 60,
+        time % MICROSECONDS,
+        tz, PyDateTimeAPI->DateTimeType));
+}
+
+static PyObject* newTimestamp(const i64 micros, PyObject* tz)
+{
+    const i64 days = floorDiv(micros, MICROSECONDS_PER_DAY);
+    return newDateTime(civilFromDays(days), micros - days * MICROSECONDS_PER_DAY, tz);
+}
+
+static PyObject* decodeDate(const TypeNode* node, const u8** const data)
+{
+    (void)node;
+    const i32 days = readI32(data);
+    return newDate(days, civilFromDays(days));
+}
+
+static PyObject* decodeTime(const TypeNode* node, const u8** const data)
+{
+    (void)node;
+    const i64 time = readI64(data);
+    const int hour = time / (60 * 60 * MICROSECONDS);
+    const int minute = time / (60 * MICROSECONDS) % 60;
+    const int second = time / MICROSECONDS % 60;
+    const int usecond = time % MICROSECONDS;
+    return checked(PyTime_FromTime(hour, minute, second, usecond));
+}
+
+static PyObject* decodeTimeWithTimeZone(const TypeNode* node, const u8** const data)
+{
+    (void)node;
+    const i64 time = readI64(data);
+    const i16 offset = readI16(data);
+    const int hour = time / (60 * 60 * MICROSECONDS);
+    const int minute = time / (60 * MICROSECONDS) % 60;
+    const int second = time / MICROSECONDS % 60;
+    const int usecond = time % MICROSECONDS;
+    PyObject* tz = timeZone(offset);
+    PyObject* value = checked(PyDateTimeAPI->Time_FromTime(
+        hour, minute, second, usecond, tz, PyDateTimeAPI->TimeType));
+    Py_DECREF(tz);
+    return value;
+}
+
+static PyObject* decodeTimestamp(const TypeNode* node, const u8** const data)
+{
+    (void)node;
+    const i64 ts = readI64(data);
+    return newTimestamp(ts, Py_None);
+}
+
+static PyObject* decodeTimestampWithTimeZone(const TypeNode* node, const u8** const data)
+{
+    (void)node;
+    const i64 ts = readI64(data);
+    const i16 offset = readI16(data);
+    PyObject* tz = timeZone(offset);
+    PyObject* value = newTimestamp(ts + offset * 60 * MICROSECONDS, tz);
+    Py_DECREF(tz);
+    return value;
+}
+
+static PyObject* decodeIntervalYearToMonth(const TypeNode* node, const u8** const data)
+{
+    (void)node;
+    const i32 months = readI32(data);
+    return checked(PyLong_FromLong(months));
+}
+
+static PyObject* decodeIntervalDayToSecond(const TypeNode* node, const u8** const data)
+{
+    (void)node;
+    const i64 millis = readI64(data);
+    const int days = millis / (24 * 60 * 60 * 1000);
+    const int seconds = (millis / 1000) % (24 * 60 * 60);
+    const int micros = (millis % 1000) * 1000;
+    return checked(PyDelta_FromDSU(days, seconds, micros));
+}
+
+static PyObject* decodeUuid(const TypeNode* node, const u8** const data)
+{
+    (void)node;
+    PyObject* value = newSlotObject(host.uuidClass);
+    *slot(value, host.uuidIntOffset) = checked(PyLong_FromUnsignedNativeBytes(*data, 16, Py_ASNATIVEBYTES_BIG_ENDIAN));
+    *slot(value, host.uuidIsSafeOffset) = Py_NewRef(host.uuidSafeUnknown);
+    *data += 16;
+    return value;
+}
+
+static PyObject* decodeIpAddress(const TypeNode* node, const u8** const data)
+{
+    (void)node;
+    const u32* raw = (u32*)*data;
+    PyObject* value;
+    if (raw[0] == 0x00000000 && raw[1] == 0x00000000 && raw[2] == 0xFFFF0000) {
+        value = newSlotObject(host.ipaddressV4Class);
+        *slot(value, host.ipv4IpOffset) = checked(PyLong_FromUnsignedNativeBytes(*data + 12, 4, Py_ASNATIVEBYTES_BIG_ENDIAN));
+    }
+    else {
+        value = newSlotObject(host.ipaddressV6Class);
+        *slot(value, host.ipv6IpOffset) = checked(PyLong_FromUnsignedNativeBytes(*data, 16, Py_ASNATIVEBYTES_BIG_ENDIAN));
+        *slot(value, host.ipv6ScopeIdOffset) = Py_NewRef(Py_None);
+    }
+    *data += 16;
+    return value;
+}
+
+static bool encodeField(const TypeNode* node, PyObject* input, Buffer* buffer)
+{
+    bool present = input != Py_None;
+    bufferAppendI8(buffer, present);
+    if (!present) {
+        DEBUG("buildResult: present=false");
+        return true;
+    }
+    DEBUG("buildResult: type=%d", node->type);
+    stats.encodedValues[node->type]++;
+    return node->encode(node, input, buffer);
+}
+
+// argument proxies, which guests may return in place of a tuple, list or dict
+static PyTypeObject lazyMapType;
+static PyTypeObject lazyArrayType;
+static PyTypeObject lazyRowType;
+
+static bool encodeLazy(const TypeNode* node, PyObject* input, Buffer* buffer);
+
+// bodies of the ROW, ARRAY and MAP encoders, shared with the exact type
+// encoders once the input has been checked
+static bool encodeTupleFields(const TypeNode* node, PyObject* input, Buffer* buffer)
+{
+    const TypeNode* field = node + 1;
+    for (i32 i = 0; i < node->count; i++) {
+        if (!encodeField(field, PyTuple_GET_ITEM(input, i), buffer)) {
+            return false;
+        }
+        field = nextSibling(field);
+    }
+    return true;
+}
+
+static bool encodeListElements(const TypeNode* node, PyObject* input, Buffer* buffer)
+{
+    const TypeNode* element = node + 1;
+    const i32 size = PyList_GET_SIZE(input);
+    bufferAppendI32(buffer, size);
+    for (i32 i = 0; i < size; i++) {
+        if (!encodeField(element, PyList_GET_ITEM(input, i), buffer)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool encodeDictEntries(const TypeNode* node, PyObject* input, Buffer* buffer)
+{
+    const TypeNode* keyNode = node + 1;
+    const TypeNode* valueNode = nextSibling(keyNode);
+    bufferAppendI32(buffer, PyDict_GET_SIZE(input));
+    PyObject* key;
+    PyObject* value;
+    Py_ssize_t pos = 0;
+    while (PyDict_Next(input, &pos, &key, &value)) {
+        if (!encodeField(keyNode, key, buffer) || !encodeField(valueNode, value, buffer)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool encodeRow(const TypeNode* node, PyObject* input, Buffer* buffer)
+{
+    if (PyObject_TypeCheck(input, &lazyRowType)) {
+        return encodeLazy(node, input, buffer);
+    }
+    if (!checkType(input, &PyTuple_Type)) {
+        resultError(input, "ROW");
+        return false;
+    }
+    if (PyTuple_Size(input) != node->count) {
+        PyErr_Format(PyExc_ValueError, "tuple has %d fields, expected %d fields for row",
+                     PyTuple_Size(input), node->count);
+        resultError(input, "ROW");
+        return false;
+    }
+    return encodeTupleFields(node, input, buffer);
+}
+
+static bool encodeArray(const TypeNode* node, PyObject* input, Buffer* buffer)
+{
+    if (PyObject_TypeCheck(input, &lazyArrayType)) {
+        return encodeLazy(node, input, buffer);
+    }
+    if (!checkType(input, &PyList_Type)) {
+        resultError(input, "ARRAY");
+        return false;
+    }
+    return encodeListElements(node, input, buffer);
+}
+
+static bool encodeMap(const TypeNode* node, PyObject* input, Buffer* buffer)
+{
+    if (PyObject_TypeCheck(input, &lazyMapType)) {
+        return encodeLazy(node, input, buffer);
+    }
+    if (!checkType(input, &PyDict_Type)) {
+        resultError(input, "MAP");
+        return false;
+    }
+    return encodeDictEntries(node, input, buffer);
+}
+
+static bool encodeBoolean(const TypeNode* node, PyObject* input, Buffer* buffer)
+{
+    (void)node;
+    int value = PyObject_IsTrue(input);
+    if (value == -1) {
+        resultError(input, "BOOLEAN");
+        return false;
+    }
+    bufferAppendI8(buffer, value);
+    return true;
+}
+
+static bool encodeBigint(const TypeNode* node, PyObject* input, Buffer* buffer)
+{
+    (void)node;
+    int overflow;
+    const i64 value = PyLong_AsLongLongAndOverflow(input, &overflow);
+    if (value == -1 && PyErr_Occurred()) {
+        resultError(input, "BIGINT");
+        return false;
+    }
+    if (overflow) {
+        overflowError("Value out of range for BIGINT");
+        return false;
+    }
+    bufferAppendI64(buffer, value);
+    return true;
+}
+
+static bool encodeInteger(const TypeNode* node, PyObject* input, Buffer* buffer)
+{
+    (void)node;
+    int overflow;
+    const i32 value = PyLong_AsLongAndOverflow(input, &overflow);
+    if (value == -1 && PyErr_Occurred()) {
+        resultError(input, "INTEGER");
+        return false;
+    }
+    if (overflow) {
+        overflowError("Value out of range for INTEGER");
+        return false;
+    }
+    bufferAppendI32(buffer, value);
+    return true;
+}
+
+static bool encodeSmallint(const TypeNode* node, PyObject* input, Buffer* buffer)
+{
+    (void)node;
+    int overflow;
+    const i32 value = PyLong_AsLongAndOverflow(input, &overflow);
+    if (value == -1 && PyErr_Occurred()) {
+        resultError(input, "SMALLINT");
+        return false;
+    }
+    if (overflow || value < INT16_MIN || value > INT16_MAX) {
+        overflowError("Value out of range for SMALLINT");
+        return false;
+    }
+    bufferAppendI16(buffer, value);
+    return true;
+}
+
+static bool encodeTinyint(const TypeNode* node, PyObject* input, Buffer* buffer)
+{
+    (void)node;
+    int overflow;
+    const i32 value = PyLong_AsLongAndOverflow(input, &overflow);
+    if (value == -1 && PyErr_Occurred()) {
+        resultError(input, "TINYINT");
+        return false;
+    }
+    if (overflow || value < INT8_MIN || value > INT8_MAX) {
+        overflowError("Value out of range for TINYINT");
+        return false;
+    }
+    bufferAppendI8(buffer, value);
+    return true;
+}
+
+static bool encodeDouble(const TypeNode* node, PyObject* input, Buffer* buffer)
+{
+    (void)node;
+    const f64 value = PyFloat_AsDouble(input);
+    if (value == -1.0 && PyErr_Occurred()) {
+        resultError(input, "DOUBLE");
+        return false;
+    }
+    bufferAppend(buffer, (u8*)&value, sizeof(f64));
+    return true;
+}
+
+static bool encodeReal(const TypeNode* node, PyObject* input, Buffer* buffer)
+{
+    (void)node;
+    const f32 value = PyFloat_AsDouble(input);
+    if (value == -1.0 && PyErr_Occurred()) {
+        resultError(input, "REAL");
+        return false;
+    }
+    bufferAppend(buffer, (u8*)&value, sizeof(f32));
+    return true;
+}
+
+static bool encodeDecimal(const TypeNode* node, PyObject* input, Buffer* buffer)
+{
+    const bool number = node->type == NUMBER;
+    const char* typeName = number ? "NUMBER" : "DECIMAL";
+    PyObject* string = PyObject_CallOneArg(number ? host.numberToStringFunction : host.decimalToStringFunction, input);
+    if (string == NULL) {
+        resultError(input, typeName);
+        return false;
+    }
+    if (!bufferAppendString(buffer, string)) {
+        Py_DECREF(string);
+        resultError(input, typeName);
+        return false;
+    }
+    Py_DECREF(string);
+    return true;
+}
+
+// rounds half up to the scale of the type, as Trino does for decimal casts
+static bool encodeUnscaledDecimal(const TypeNode* node, PyObject* input, Buffer* buffer)
+{
+    if (!checkType(input, (PyTypeObject*)host.decimalClass)) {
+        resultError(input, "DECIMAL");
+        return false;
+    }
+    PyObject* scaled = PyObject_CallMethod(input, "scaleb", "iO", node->scale, host.decimalContext);
+    if (scaled == NULL) {
+        resultError(input, "DECIMAL");
+        return false;
+    }
+    PyObject* integral = PyObject_CallMethod(scaled, "to_integral_value", "OO", Py_None, host.decimalContext);
+    Py_DECREF(scaled);
+    if (integral == NULL) {
+        resultError(input, "DECIMAL");
+        return false;
+    }
+    PyObject* unscaled = PyNumber_Long(integral);
+    Py_DECREF(integral);
+    if (unscaled == NULL) {
+        resultError(input, "DECIMAL");
+        return false;
+    }
+
+    i128 value;
+    const Py_ssize_t required = PyLong_AsNativeBytes(unscaled, &value, sizeof(value), Py_ASNATIVEBYTES_LITTLE_ENDIAN);
+    Py_DECREF(unscaled);
+    if (required < 0) {
+        resultError(input, "DECIMAL");
+        return false;
+    }
+    i128 limit = 1;
+    for (i32 i = 0; i < node->precision; i++) {
+        limit *= 10;
+    }
+    if (required > (Py_ssize_t)sizeof(value) || value >= limit || value <= -limit) {
+        overflowError("Value out of range for DECIMAL");
+        return false;
+    }
+
+    bufferAppend(buffer, (u8*)&value, node->width);
+    return true;
+}
+
+static bool encodeVarchar(const TypeNode* node, PyObject* input, Buffer* buffer)
+{
+    const char* typeName = node->type == VARCHAR ? "VARCHAR" : "JSON";
+    if (!checkType(input, &PyUnicode_Type)) {
+        resultError(input, typeName);
+        return false;
+    }
+    if (!bufferAppendString(buffer, input)) {
+        resultError(input, typeName);
+        return false;
+    }
+    return true;
+}
+
+static bool encodeVarbinary(const TypeNode* node, PyObject* input, Buffer* buffer)
+{
+    (void)node;
+    Py_buffer view;
+    if (PyObject_GetBuffer(input, &view, PyBUF_SIMPLE) == -1) {
+        resultError(input, "VARBINARY");
+        return false;
+    }
+    bufferAppendI32(buffer, view.len);
+    bufferAppend(buffer, view.buf, view.len);
+    PyBuffer_Release(&view);
+    return true;
+}
+
+static bool encodeDate(const TypeNode* node, PyObject* input, Buffer* buffer)
+{
+    (void)node;
+    if (!checkType(input, PyDateTimeAPI->DateType)) {
+        resultError(input, "DATE");
+        return false;
+    }
+    const i32 days = daysFromCivil(
+        PyDateTime_GET_YEAR(input),
+        PyDateTime_GET_MONTH(input),
+        PyDateTime_GET_DAY(input));
+    bufferAppendI32(buffer, days);
+    return true;
+}
+
+static bool encodeTime(const TypeNode* node, PyObject* input, Buffer* buffer)
+{
+    (void)node;
+    if (!checkType(input, PyDateTimeAPI->TimeType)) {
+        resultError(input, "TIME");
+        return false;
+    }
+    const i64 micros =
+        PyDateTime_TIME_GET_HOUR(input) * (60 * 60 * MICROSECONDS) +
+        PyDateTime_TIME_GET_MINUTE(input) * (60 * MICROSECONDS) +
+        PyDateTime_TIME_GET_SECOND(input) * MICROSECONDS +
+        PyDateTime_TIME_GET_MICROSECOND(input);
+    bufferAppendI64(buffer, micros);
+    return true;
+}
+
+static bool encodeTimeWithTimeZone(const TypeNode* node, PyObject* input, Buffer* buffer)
+{
+    (void)node;
+    if (!checkType(input, PyDateTimeAPI->TimeType)) {
+        resultError(input, "TIME WITH TIME ZONE");
+        return false;
+    }
+    const i64 micros =
+        PyDateTime_TIME_GET_HOUR(input) * (60 * 60 * MICROSECONDS) +
+        PyDateTime_TIME_GET_MINUTE(input) * (60 * MICROSECONDS) +
+        PyDateTime_TIME_GET_SECOND(input) * MICROSECONDS +
+        PyDateTime_TIME_GET_MICROSECOND(input);
+    bufferAppendI64(buffer, micros);
+    PyObject* delta = PyObject_CallMethod(input, "utcoffset", NULL);
+    if (delta == NULL || delta == Py_None) {
+        if (delta == Py_None) {
+            PyErr_Format(PyExc_ValueError, "time instance does not have tzinfo");
+        }
+        resultError(input, "TIME WITH TIME ZONE");
+        return false;
+    }
+    const i16 offset =
+        PyDateTime_DELTA_GET_DAYS(delta) * 24 * 60 +
+        PyDateTime_DELTA_GET_SECONDS(delta) / 60;
+    Py_DECREF(delta);
+    bufferAppendI16(buffer, offset);
+    return true;
+}
+
+// microseconds since the epoch for the civil date and time, ignoring tzinfo
+static i64 timestampMicros(PyObject* input)
+{
+    const i64 days = daysFromCivil(
+        PyDateTime_GET_YEAR(input),
+        PyDateTime_GET_MONTH(input),
+        PyDateTime_GET_DAY(input));
+    return days * MICROSECONDS_PER_DAY +
+        PyDateTime_DATE_GET_HOUR(input) * (60 * 60 * MICROSECONDS) +
+        PyDateTime_DATE_GET_MINUTE(input) * (60 * MICROSECONDS) +
+        PyDateTime_DATE_GET_SECOND(input) * MICROSECONDS +
+        PyDateTime_DATE_GET_MICROSECOND(input);
+}
+
+static bool encodeTimestamp(const TypeNode* node, PyObject* input, Buffer* buffer)
+{
+    (void)node;
+    if (!checkType(input, PyDateTimeAPI->DateTimeType)) {
+        resultError(input, "TIMESTAMP");
+        return false;
+    }
+    i64 micros = timestampMicros(input);
+    bufferAppendI64(buffer, micros);
+    return true;
+}
+
+static bool encodeTimestampWithTimeZone(const TypeNode* node, PyObject* input, Buffer* buffer)
+{
+    (void)node;
+    if (!checkType(input, PyDateTimeAPI->DateTimeType)) {
+        resultError(input, "TIMESTAMP WITH TIME ZONE");
+        return false;
+    }
+    i64 micros = timestampMicros(input);
+    PyObject* delta = PyObject_CallMethod(input, "utcoffset", NULL);
+    if (delta == NULL || delta == Py_None) {
+        if (delta == Py_None) {
+            PyErr_Format(PyExc_ValueError, "datetime instance does not have tzinfo");
+        }
+        resultError(input, "TIMESTAMP WITH TIME ZONE");
+        return false;
+    }
+    const i16 offset =
+        PyDateTime_DELTA_GET_DAYS(delta) * 24 * 60 +
+        PyDateTime_DELTA_GET_SECONDS(delta) / 60;
+    micros -= offset * 60 * MICROSECONDS;
+    bufferAppendI64(buffer, micros);
+    bufferAppendI16(buffer, offset);
+    Py_DECREF(delta);
+    return true;
+}
+
+static bool encodeIntervalYearToMonth(const TypeNode* node, PyObject* input, Buffer* buffer)
+{
+    (void)node;
+    int overflow;
+    const i32 value = PyLong_AsLongAndOverflow(input, &overflow);
+    if (value == -1 && PyErr_Occurred()) {
+        resultError(input, "INTERVAL YEAR TO MONTH");
+        return false;
+    }
+    if (overflow) {
+        overflowError("Value out of range for INTERVAL YEAR TO MONTH");
+        return false;
+    }
+    bufferAppendI32(buffer, value);
+    return true;
+}
+
+static bool encodeIntervalDayToSecond(const TypeNode* node, PyObject* input, Buffer* buffer)
+{
+    (void)node;
+    if (!checkType(input, PyDateTimeAPI->DeltaType)) {
+        resultError(input, "INTERVAL DAY TO SECOND");
+        return false;
+    }
+    const i64 value =
+        PyDateTime_DELTA_GET_DAYS(input) * (24 * 60 * 60 * 1000) +
+        PyDateTime_DELTA_GET_SECONDS(input) * 1000 +
+        (PyDateTime_DELTA_GET_MICROSECONDS(input) + 500) / 1000;
+    bufferAppendI64(buffer, value);
+    return true;
+}
+
+static bool encodeUuid(const TypeNode* node, PyObject* input, Buffer* buffer)
+{
+    (void)node;
+    if (!checkType(input, _PyType_CAST(host.uuidClass))) {
+        resultError(input, "UUID");
+        return false;
+    }
+    return appendIntSlot(input, host.uuidIntOffset, 16, buffer, "UUID");
+}
+
+static bool encodeIpAddress(const TypeNode* node, PyObject* input, Buffer* buffer)
+{
+    (void)node;
+    // IPv4 addresses are encoded as IPv4-mapped IPv6 addresses
+    if (PyObject_TypeCheck(input, _PyType_CAST(host.ipaddressV4Class))) {
+        static const u8 prefix[12] = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xFF, 0xFF};
+        bufferAppend(buffer, prefix, sizeof(prefix));
+        return appendIntSlot(input, host.ipv4IpOffset, 4, buffer, "IPADDRESS");
+    }
+    if (!PyObject_TypeCheck(input, _PyType_CAST(host.ipaddressV6Class))) {
+        PyErr_Format(PyExc_TypeError, "expected an instance of type '%N' or '%N'",
+                     host.ipaddressV4Class, host.ipaddressV6Class);
+        resultError(input, "IPADDRESS");
+        return false;
+    }
+    return appendIntSlot(input, host.ipv6IpOffset, 16, buffer, "IPADDRESS");
+}
+
+// Size of the encoded result value, which is exact or an upper bound for the
+// types that can be sized without conversion, or a guess for the others.
+static i64 estimateField(const TypeNode* node, PyObject* input)
+{
+    if (input == Py_None) {
+        return sizeof(i8);
+    }
+    if (node->width > 0) {
+        return sizeof(i8) + node->width;
+    }
+
+    i64 size = sizeof(i8);
+    switch (node->type) {
+        case ROW: {
+            if (!PyTuple_Check(input) || PyTuple_GET_SIZE(input) != node->count) {
+                return size;
+            }
+            const TypeNode* field = node + 1;
+            for (i32 i = 0; i < node->count; i++) {
+                size += estimateField(field, PyTuple_GET_ITEM(input, i));
+                field = nextSibling(field);
+            }
+            return size;
+        }
+        case ARRAY: {
+            if (!PyList_Check(input)) {
+                return size;
+            }
+            const TypeNode* element = node + 1;
+            const Py_ssize_t count = PyList_GET_SIZE(input);
+            size += sizeof(i32);
+            if (element->width > 0) {
+                return size + count * (sizeof(i8) + element->width);
+            }
+            for (Py_ssize_t i = 0; i < count; i++) {
+                size += estimateField(element, PyList_GET_ITEM(input, i));
+            }
+            return size;
+        }
+        case MAP: {
+            if (!PyDict_Check(input)) {
+                return size;
+            }
+            const TypeNode* keyNode = node + 1;
+            const TypeNode* valueNode = nextSibling(keyNode);
+            size += sizeof(i32);
+            if (keyNode->width > 0 && valueNode->width > 0) {
+                return size + PyDict_GET_SIZE(input) * (2 * sizeof(i8) + keyNode->width + valueNode->width);
+            }
+            PyObject* key;
+            PyObject* value;
+            Py_ssize_t pos = 0;
+            while (PyDict_Next(input, &pos, &key, &value)) {
+                size += estimateField(keyNode, key) + estimateField(valueNode, value);
+            }
+            return size;
+        }
+        case VARCHAR:
+        case JSON: {
+            Py_ssize_t length;
+            if (!PyUnicode_Check(input) || PyUnicode_AsUTF8AndSize(input, &length) == NULL) {
+                PyErr_Clear();
+                return size;
+            }
+            return size + sizeof(i32) + length;
+        }
+        case VARBINARY:
+            if (PyBytes_Check(input)) {
+                return size + sizeof(i32) + PyBytes_GET_SIZE(input);
+            }
+            if (PyByteArray_Check(input)) {
+                return size + sizeof(i32) + PyByteArray_GET_SIZE(input);
+            }
+            return size + sizeof(i32);
+        default:
+            return size + 32;
+    }
+}
+
+// reserve the buffer for the whole result so encoding does not have to grow it
+static void reserveResult(Buffer* buffer, const TypeNode* node, PyObject* input)
+{
+    const i64 size = estimateField(node, input);
+    if (size > INT32_MAX - buffer->used) {
+        return;
+    }
+    bufferReserve(buffer, buffer->used + size);
+}
+
+static const struct
+{
+    Decoder decode;
+    Encoder encode;
+} converters[] = {
+    [ROW] = {decodeRow, encodeRow},
+    [ARRAY] = {decodeArray, encodeArray},
+    [MAP] = {decodeMap, encodeMap},
+    [BOOLEAN] = {decodeBoolean, encodeBoolean},
+    [BIGINT] = {decodeBigint, encodeBigint},
+    [INTEGER] = {decodeInteger, encodeInteger},
+    [SMALLINT] = {decodeSmallint, encodeSmallint},
+    [TINYINT] = {decodeTinyint, encodeTinyint},
+    [DOUBLE] = {decodeDouble, encodeDouble},
+    [REAL] = {decodeReal, encodeReal},
+    [DECIMAL] = {decodeDecimal, encodeDecimal},
+    [VARCHAR] = {decodeVarchar, encodeVarchar},
+    [VARBINARY] = {decodeVarbinary, encodeVarbinary},
+    [DATE] = {decodeDate, encodeDate},
+    [TIME] = {decodeTime, encodeTime},
+    [TIME_WITH_TIME_ZONE] = {decodeTimeWithTimeZone, encodeTimeWithTimeZone},
+    [TIMESTAMP] = {decodeTimestamp, encodeTimestamp},
+    [TIMESTAMP_WITH_TIME_ZONE] = {decodeTimestampWithTimeZone, encodeTimestampWithTimeZone},
+    [INTERVAL_YEAR_TO_MONTH] = {decodeIntervalYearToMonth, encodeIntervalYearToMonth},
+    [INTERVAL_DAY_TO_SECOND] = {decodeIntervalDayToSecond, encodeIntervalDayToSecond},
+    [JSON] = {decodeVarchar, encodeVarchar},
+    [UUID] = {decodeUuid, encodeUuid},
+    [IPADDRESS] = {decodeIpAddress, encodeIpAddress},
+    [NUMBER] = {decodeDecimal, encodeDecimal},
+    [UNSCALED_DECIMAL] = {decodeUnscaledDecimal, encodeUnscaledDecimal},
+};
+
+// Encoders selected by the return type hint of the function. They take a
+// fast path for values of exactly the hinted Python type, and fall back to
+// the generic encoder, with its conversions and errors, for anything else.
+static bool encodeExactTuple(const TypeNode* node, PyObject* input, Buffer* buffer)
+{
+    if (!PyTuple_CheckExact(input) || PyTuple_GET_SIZE(input) != node->count) {
+        return encodeRow(node, input, buffer);
+    }
+    return encodeTupleFields(node, input, buffer);
+}
+
+static bool encodeExactList(const TypeNode* node, PyObject* input, Buffer* buffer)
+{
+    if (!PyList_CheckExact(input)) {
+        return encodeArray(node, input, buffer);
+    }
+    return encodeListElements(node, input, buffer);
+}
+
+static bool encodeExactDict(const TypeNode* node, PyObject* input, Buffer* buffer)
+{
+    if (!PyDict_CheckExact(input)) {
+        return encodeMap(node, input, buffer);
+    }
+    return encodeDictEntries(node, input, buffer);
+}
+
+static bool encodeExactBool(const TypeNode* node, PyObject* input, Buffer* buffer)
+{
+    if (input != Py_True && input != Py_False) {
+        return encodeBoolean(node, input, buffer);
+    }
+    bufferAppendI8(buffer, input == Py_True);
+    return true;
+}
+
+// value of an exact int that fits in a single digit, which is within the
+// INTEGER range for both digit sizes
+static bool compactLong(PyObject* input, i64* value)
+{
+    if (!PyLong_CheckExact(input) || !PyUnstable_Long_IsCompact((PyLongObject*)input)) {
+        return false;
+    }
+    *value = PyUnstable_Long_CompactValue((PyLongObject*)input);
+    return true;
+}
+
+static bool encodeExactBigint(const TypeNode* node, PyObject* input, Buffer* buffer)
+{
+    i64 value;
+    if (!compactLong(input, &value)) {
+        return encodeBigint(node, input, buffer);
+    }
+    bufferAppendI64(buffer, value);
+    return true;
+}
+
+static bool encodeExactInteger(const TypeNode* node, PyObject* input, Buffer* buffer)
+{
+    i64 value;
+    if (!compactLong(input, &value)) {
+        return encodeInteger(node, input, buffer);
+    }
+    bufferAppendI32(buffer, value);
+    return true;
+}
+
+static bool encodeExactSmallint(const TypeNode* node, PyObject* input, Buffer* buffer)
+{
+    i64 value;
+    if (!compactLong(input, &value) || value < INT16_MIN || value > INT16_MAX) {
+        return encodeSmallint(node, input, buffer);
+    }
+    bufferAppendI16(buffer, value);
+    return true;
+}
+
+static bool encodeExactTinyint(const TypeNode* node, PyObject* input, Buffer* buffer)
+{
+    i64 value;
+    if (!compactLong(input, &value) || value < INT8_MIN || value > INT8_MAX) {
+        return encodeTinyint(node, input, buffer);
+    }
+    bufferAppendI8(buffer, value);
+    return true;
+}
+
+static bool encodeExactDouble(const TypeNode* node, PyObject* input, Buffer* buffer)
+{
+    if (!PyFloat_CheckExact(input)) {
+        return encodeDouble(node, input, buffer);
+    }
+    const f64 value = PyFloat_AS_DOUBLE(input);
+    bufferAppend(buffer, (u8*)&value, sizeof(f64));
+    return true;
+}
+
+static bool encodeExactReal(const TypeNode* node, PyObject* input, Buffer* buffer)
+{
+    if (!PyFloat_CheckExact(input)) {
+        return encodeReal(node, input, buffer);
+    }
+    const f32 value = PyFloat_AS_DOUBLE(input);
+    bufferAppend(buffer, (u8*)&value, sizeof(f32));
+    return true;
+}
+
+static bool encodeExactStr(const TypeNode* node, PyObject* input, Buffer* buffer)
+{
+    if (PyUnicode_CheckExact(input) && bufferAppendString(buffer, input)) {
+        return true;
+    }
+    // let the generic encoder report the failure
+    PyErr_Clear();
+    return encodeVarchar(node, input, buffer);
+}
+
+static bool encodeExactBytes(const TypeNode* node, PyObject* input, Buffer* buffer)
+{
+    if (!PyBytes_CheckExact(input)) {
+        return encodeVarbinary(node, input, buffer);
+    }
+    bufferAppendI32(buffer, PyBytes_GET_SIZE(input));
+    bufferAppend(buffer, (u8*)PyBytes_AS_STRING(input), PyBytes_GET_SIZE(input));
+    return true;
+}
+
+static const struct
+{
+    PyTypeObject* hint;
+    Encoder encode;
+} exactEncoders[TRINO_TYPE_COUNT] = {
+    [ROW] = {&PyTuple_Type, encodeExactTuple},
+    [ARRAY] = {&PyList_Type, encodeExactList},
+    [MAP] = {&PyDict_Type, encodeExactDict},
+    [BOOLEAN] = {&PyBool_Type, encodeExactBool},
+    [BIGINT] = {&PyLong_Type, encodeExactBigint},
+    [INTEGER] = {&PyLong_Type, encodeExactInteger},
+    [SMALLINT] = {&PyLong_Type, encodeExactSmallint},
+    [TINYINT] = {&PyLong_Type, encodeExactTinyint},
+    [DOUBLE] = {&PyFloat_Type, encodeExactDouble},
+    [REAL] = {&PyFloat_Type, encodeExactReal},
+    [VARCHAR] = {&PyUnicode_Type, encodeExactStr},
+    [VARBINARY] = {&PyBytes_Type, encodeExactBytes},
+    [JSON] = {&PyUnicode_Type, encodeExactStr},
+};
+
+// advance past an encoded value without decoding it
+static void skipField(const TypeNode* node, const u8** const data)
+{
+    if (!readI8(data)) {
+        return;
+    }
+    if (node->width > 0) {
+        *data += node->width;
+        return;
+    }
+    switch (node->type) {
+        case ROW: {
+            const TypeNode* field = node + 1;
+            for (i32 i = 0; i < node->count; i++) {
+                skipField(field, data);
+                field = nextSibling(field);
+            }
+            break;
+        }
+        case ARRAY: {
+            const i32 count = readI32(data);
+            for (i32 i = 0; i < count; i++) {
+                skipField(node + 1, data);
+            }
+            break;
+        }
+        case MAP: {
+            const TypeNode* keyNode = node + 1;
+            const TypeNode* valueNode = nextSibling(keyNode);
+            const i32 count = readI32(data);
+            for (i32 i = 0; i < count; i++) {
+                skipField(keyNode, data);
+                skipField(valueNode, data);
+            }
+            break;
+        }
+        default: {
+            const i32 size = readI32(data);
+            *data += size;
+            break;
+        }
+    }
+}
+
+// argument proxies over a copy of an encoded MAP, ARRAY or ROW value, which
+// decode elements only as they are accessed; the copy lets them outlive the
+// call, as they must not refer to the argument data or to views over it
+typedef struct
+{
+    PyObject_HEAD
+    PyObject* data; // bytes holding the encoded elements
+    TypeNode* nodes; // copy of the element plans
+    i32* offsets; // offset of each element, or map entry, in the data
+    i32* fields; // node index of each ROW field
+    i32 nodeCount;
+    i32 count;
+    PyObject* list; // ARRAY elements, once the proxy has been mutated
+} LazyObject;
+
+static i32* newOffsets(const i32 count)
+{
+    return xrealloc(NULL, (count > 0 ? count : 1) * sizeof(i32));
+}
+
+static PyObject* newLazyObject(PyTypeObject* type, const TypeNode* node, const u8* start, const u8* end, i32* offsets, const i32 count)
+{
+    const i32 nodeCount = node->size - 1;
+    TypeNode* nodes = xrealloc(NULL, (nodeCount > 0 ? nodeCount : 1) * sizeof(TypeNode));
+    memcpy(nodes, node + 1, nodeCount * sizeof(TypeNode));
+    for (i32 i = 0; i < nodeCount; i++) {
+        if (nodes[i].decode == decodeArgumentView) {
+            nodes[i].decode = converters[nodes[i].type].decode;
+        }
+    }
+
+    LazyObject* lazy = (LazyObject*)checked(type->tp_alloc(type, 0));
+    lazy->data = checked(PyBytes_FromStringAndSize((const char*)start, end - start));
+    lazy->nodes = nodes;
+    lazy->nodeCount = nodeCount;
+    lazy->offsets = offsets;
+    lazy->count = count;
+    return (PyObject*)lazy;
+}
+
+static const u8* lazyElement(const LazyObject* lazy, const i32 index)
+{
+    return (const u8*)PyBytes_AS_STRING(lazy->data) + lazy->offsets[index];
+}
+
+static void lazyDealloc(PyObject* self)
+{
+    LazyObject* lazy = (LazyObject*)self;
+    Py_XDECREF(lazy->data);
+    Py_CLEAR(lazy->list);
+    free(lazy->nodes);
+    free(lazy->offsets);
+    free(lazy->fields);
+    Py_TYPE(self)->tp_free(self);
+}
+
+static void lazyArrayDealloc(PyObject* self)
+{
+    PyObject_GC_UnTrack(self);
+    lazyDealloc(self);
+}
+
+static int lazyTraverse(PyObject* self, visitproc visit, void* arg)
+{
+    Py_VISIT(((LazyObject*)self)->list);
+    return 0;
+}
+
+static int lazyClear(PyObject* self)
+{
+    Py_CLEAR(((LazyObject*)self)->list);
+    return 0;
+}
+
+// index of an element, or -1 with IndexError set if it is out of range
+static Py_ssize_t lazyIndex(const LazyObject* lazy, Py_ssize_t index, const char* message)
+{
+    if (index < 0) {
+        index += lazy->count;
+    }
+    if (index < 0 || index >= lazy->count) {
+        PyErr_SetString(PyExc_IndexError, message);
+        return -1;
+    }
+    return index;
+}
+
+static PyObject* lazyToList(LazyObject* lazy, PyObject* (*item)(const LazyObject*, i32))
+{
+    PyObject* list = checked(PyList_New(lazy->count));
+    for (i32 i = 0; i < lazy->count; i++) {
+        PyList_SET_ITEM(list, i, item(lazy, i));
+    }
+    return list;
+}
+
+static PyObject* lazyRepr(PyObject* self, PyObject* value)
+{
+    if (value == NULL) {
+        return NULL;
+    }
+    PyObject* repr = PyUnicode_FromFormat("%s(%R)", Py_TYPE(self)->tp_name, value);
+    Py_DECREF(value);
+    return repr;
+}
+
+static PyObject* lazyCompare(PyObject* value, PyObject* other, const int op)
+{
+    if (value == NULL) {
+        return NULL;
+    }
+    PyObject* result = PyObject_RichCompare(value, other, op);
+    Py_DECREF(value);
+    return result;
+}
+
+static PyObject* lazyMapKey(const LazyObject* map, const i32 index)
+{
+    const u8* data = lazyElement(map, index);
+    return decodeField(map->nodes, &data);
+}
+
+static PyObject* lazyMapValue(const LazyObject* map, const i32 index)
+{
+    const u8* data = lazyElement(map, index);
+    skipField(map->nodes, &data);
+    return decodeField(nextSibling(map->nodes), &data);
+}
+
+// index of the entry with an equal key, -1 if absent, or -2 with a Python
+// error set; string and integer keys are compared in their encoded form
+static i32 lazyMapFind(const LazyObject* map, PyObject* key)
+{
+    const TypeNode* keyNode = map->nodes;
+    switch (keyNode->type) {
+        case VARCHAR:
+        case JSON: {
+            if (!PyUnicode_Check(key)) {
+                return -1;
+            }
+            Py_ssize_t size;
+            const char* utf8 = PyUnicode_AsUTF8AndSize(key, &size);
+            if (utf8 == NULL) {
+                return -2;
+            }
+            for (i32 i = 0; i < map->count; i++) {
+                const u8* data = lazyElement(map, i);
+                if (readI8(&data) && readI32(&data) == size && memcmp(data, utf8, size) == 0) {
+                    return i;
+                }
+            }
+            return -1;
+        }
+        case BIGINT:
+        case INTEGER:
+        case SMALLINT:
+        case TINYINT: {
+            if (!PyLong_CheckExact(key)) {
+                break;
+            }
+            int overflow;
+            const i64 value = PyLong_AsLongLongAndOverflow(key, &overflow);
+            if (overflow != 0) {
+                return -1;
+            }
+            if (value == -1 && PyErr_Occurred()) {
+                return -2;
+            }
+            for (i32 i = 0; i < map->count; i++) {
+                const u8* data = lazyElement(map, i);
+                if (!readI8(&data)) {
+                    continue;
+                }
+                i64 candidate;
+                switch (keyNode->type) {
+                    case BIGINT:
+                        candidate = readI64(&data);
+                        break;
+                    case INTEGER:
+                        candidate = readI32(&data);
+                        break;
+                    case SMALLINT:
+                        candidate = readI16(&data);
+                        break;
+                    default:
+                        candidate = readI8(&data);
+                        break;
+                }
+                if (candidate == value) {
+                    return i;
+                }
+            }
+            return -1;
+        }
+        default:
+            break;
+    }
+
+    for (i32 i = 0; i < map->count; i++) {
+        PyObject* candidate = lazyMapKey(map, i);
+        const int equal = PyObject_RichCompareBool(candidate, key, Py_EQ);
+        Py_DECREF(candidate);
+        if (equal != 0) {
+            return equal < 0 ? -2 : i;
+        }
+    }
+    return -1;
+}
+
+static PyObject* decodeLazyMap(const TypeNode* node, const u8** const data)
+{
+    const TypeNode* keyNode = node + 1;
+    const TypeNode* valueNode = nextSibling(keyNode);
+    const i32 count = readI32(data);
+    DEBUG("buildArgs: lazy entryCount=%d", count);
+    const u8* start = *data;
+    i32* offsets = newOffsets(count);
+    for (i32 i = 0; i < count; i++) {
+        offsets[i] = *data - start;
+        skipField(keyNode, data);
+        skipField(valueNode, data);
+    }
+    return newLazyObject(host.lazyMapClass, node, start, *data, offsets, count);
+}
+
+static Py_ssize_t lazyMapLength(PyObject* self)
+{
+    return ((LazyObject*)self)->count;
+}
+
+static PyObject* lazyMapSubscript(PyObject* self, PyObject* key)
+{
+    const LazyObject* map = (LazyObject*)self;
+    const i32 index = lazyMapFind(map, key);
+    if (index == -2) {
+        return NULL;
+    }
+    if (index == -1) {
+        PyErr_SetObject(PyExc_KeyError, key);
+        return NULL;
+    }
+    return lazyMapValue(map, index);
+}
+
+static int lazyMapContains(PyObject* self, PyObject* key)
+{
+    const i32 index = lazyMapFind((LazyObject*)self, key);
+    return index == -2 ? -1 : index >= 0;
+}
+
+static PyObject* lazyMapIter(PyObject* self)
+{
+    PyObject* keys = lazyToList((LazyObject*)self, lazyMapKey);
+    PyObject* iterator = PyObject_GetIter(keys);
+    Py_DECREF(keys);
+    return iterator;
+}
+
+static PyObject* lazyMapGet(PyObject* self, PyObject* const* args, const Py_ssize_t nargs)
+{
+    if (nargs < 1 || nargs > 2) {
+        PyErr_Format(PyExc_TypeError, "get expected 1 or 2 arguments, got %zd", nargs);
+        return NULL;
+    }
+    const LazyObject* map = (LazyObject*)self;
+    const i32 index = lazyMapFind(map, args[0]);
+    if (index == -2) {
+        return NULL;
+    }
+    if (index == -1) {
+        return Py_NewRef(nargs == 2 ? args[1] : Py_None);
+    }
+    return lazyMapValue(map, index);
+}
+
+static PyObject* lazyMapToDict(const LazyObject* map)
+{
+    PyObject* dict = checked(_PyDict_NewPresized(map->count));
+    for (i32 i = 0; i < map->count; i++) {
+        PyObject* key = lazyMapKey(map, i);
+        PyObject* value = lazyMapValue(map, i);
+        const int result = PyDict_SetItem(dict, key, value);
+        Py_DECREF(key);
+        Py_DECREF(value);
+        if (result == -1) {
+            Py_DECREF(dict);
+            return NULL;
+        }
+    }
+    return dict;
+}
+
+static PyObject* lazyMapRepr(PyObject* self)
+{
+    return lazyRepr(self, lazyMapToDict((LazyObject*)self));
+}
+
+static PyObject* lazyArrayItem(const LazyObject* array, const i32 index)
+{
+    const u8* data = lazyElement(array, index);
+    return decodeField(array->nodes, &data);
+}
+
+static PyObject* decodeLazyArray(const TypeNode* node, const u8** const data)
+{
+    const TypeNode* element = node + 1;
+    const i32 count = readI32(data);
+    DEBUG("buildArgs: lazy elementCount=%d", count);
+    const u8* start = *data;
+    i32* offsets = newOffsets(count);
+    for (i32 i = 0; i < count; i++) {
+        offsets[i] = *data - start;
+        skipField(element, data);
+    }
+    return newLazyObject(host.lazyArrayClass, node, start, *data, offsets, count);
+}
+
+// the list that a mutated array delegates to from then on
+static PyObject* lazyArrayList(LazyObject* array)
+{
+    if (array->list == NULL) {
+        array->list = lazyToList(array, lazyArrayItem);
+    }
+    return array->list;
+}
+
+static Py_ssize_t lazyArrayLength(PyObject* self)
+{
+    const LazyObject* array = (LazyObject*)self;
+    return array->list != NULL ? PyList_GET_SIZE(array->list) : array->count;
+}
+
+static PyObject* lazyArrayGetItem(PyObject* self, const Py_ssize_t index)
+{
+    const LazyObject* array = (LazyObject*)self;
+    if (array->list != NULL) {
+        return PySequence_GetItem(array->list, index);
+    }
+    const Py_ssize_t element = lazyIndex(array, index, "list index out of range");
+    if (element == -1) {
+        return NULL;
+    }
+    return lazyArrayItem(array, element);
+}
+
+static PyObject* lazyArraySubscript(PyObject* self, PyObject* key)
+{
+    LazyObject* array = (LazyObject*)self;
+    if (array->list == NULL && PyIndex_Check(key)) {
+        const Py_ssize_t index = PyNumber_AsSsize_t(key, PyExc_IndexError);
+        if (index == -1 && PyErr_Occurred()) {
+            return NULL;
+        }
+        return lazyArrayGetItem(self, index);
+    }
+    if (array->list == NULL) {
+        PyObject* list = lazyToList(array, lazyArrayItem);
+        PyObject* result = PyObject_GetItem(list, key);
+        Py_DECREF(list);
+        return result;
+    }
+    return PyObject_GetItem(array->list, key);
+}
+
+static int lazyArrayAssignSubscript(PyObject* self, PyObject* key, PyObject* value)
+{
+    PyObject* list = lazyArrayList((LazyObject*)self);
+    return value == NULL ? PyObject_DelItem(list, key) : PyObject_SetItem(list, key, value);
+}
+
+static int lazyArrayContains(PyObject* self, PyObject* value)
+{
+    const LazyObject* array = (LazyObject*)self;
+    if (array->list != NULL) {
+        return PySequence_Contains(array->list, value);
+    }
+    for (i32 i = 0; i < array->count; i++) {
+        PyObject* element = lazyArrayItem(array, i);
+        const int equal = PyObject_RichCompareBool(element, value, Py_EQ);
+        Py_DECREF(element);
+        if (equal != 0) {
+            return equal;
+        }
+    }
+    return 0;
+}
+
+static PyObject* lazyArrayIter(PyObject* self)
+{
+    const LazyObject* array = (LazyObject*)self;
+    return array->list != NULL ? PyObject_GetIter(array->list) : PySeqIter_New(self);
+}
+
+static PyObject* lazyArrayInsert(PyObject* self, PyObject* const* args, const Py_ssize_t nargs)
+{
+    if (nargs != 2) {
+        PyErr_Format(PyExc_TypeError, "insert expected 2 arguments, got %zd", nargs);
+        return NULL;
+    }
+    return PyObject_CallMethod(lazyArrayList((LazyObject*)self), "insert", "OO", args[0], args[1]);
+}
+
+static PyObject* lazyArrayValue(LazyObject* array)
+{
+    return array->list != NULL ? Py_NewRef(array->list) : lazyToList(array, lazyArrayItem);
+}
+
+static PyObject* lazyArrayRepr(PyObject* self)
+{
+    return lazyRepr(self, lazyArrayValue((LazyObject*)self));
+}
+
+static PyObject* lazyArrayCompare(PyObject* self, PyObject* other, const int op)
+{
+    return lazyCompare(lazyArrayValue((LazyObject*)self), other, op);
+}
+
+static PyObject* lazyRowItem(const LazyObject* row, const i32 index)
+{
+    const u8* data = lazyElement(row, index);
+    return decodeField(row->nodes + row->fields[index], &data);
+}
+
+static PyObject* decodeLazyRow(const TypeNode* node, const u8** const data)
+{
+    DEBUG("buildArgs: lazy fieldCount=%d", node->count);
+    const u8* start = *data;
+    i32* offsets = newOffsets(node->count);
+    i32* fields = newOffsets(node->count);
+    const TypeNode* field = node + 1;
+    for (i32 i = 0; i < node->count; i++) {
+        offsets[i] = *data - start;
+        fields[i] = field - (node + 1);
+        skipField(field, data);
+        field = nextSibling(field);
+    }
+    LazyObject* row = (LazyObject*)newLazyObject(host.lazyRowClass, node, start, *data, offsets, node->count);
+    row->fields = fields;
+    return (PyObject*)row;
+}
+
+static PyObject* lazyRowTuple(LazyObject* row)
+{
+    PyObject* tuple = checked(PyTuple_New(row->count));
+    for (i32 i = 0; i < row->count; i++) {
+        PyTuple_SET_ITEM(tuple, i, lazyRowItem(row, i));
+    }
+    return tuple;
+}
+
+static Py_ssize_t lazyRowLength(PyObject* self)
+{
+    return ((LazyObject*)self)->count;
+}
+
+static PyObject* lazyRowGetItem(PyObject* self, const Py_ssize_t index)
+{
+    const LazyObject* row = (LazyObject*)self;
+    const Py_ssize_t element = lazyIndex(row, index, "tuple index out of range");
+    if (element == -1) {
+        return NULL;
+    }
+    return lazyRowItem(row, element);
+}
+
+static PyObject* lazyRowSubscript(PyObject* self, PyObject* key)
+{
+    if (PyIndex_Check(key)) {
+        const Py_ssize_t index = PyNumber_AsSsize_t(key, PyExc_IndexError);
+        if (index == -1 && PyErr_Occurred()) {
+            return NULL;
+        }
+        return lazyRowGetItem(self, index);
+    }
+    PyObject* tuple = lazyRowTuple((LazyObject*)self);
+    PyObject* result = PyObject_GetItem(tuple, key);
+    Py_DECREF(tuple);
+    return result;
+}
+
+static PyObject* lazyRowIter(PyObject* self)
+{
+    return PySeqIter_New(self);
+}
+
+static PyObject* lazyRowRepr(PyObject* self)
+{
+    return lazyRepr(self, lazyRowTuple((LazyObject*)self));
+}
+
+static PyObject* lazyRowCompare(PyObject* self, PyObject* other, const int op)
+{
+    return lazyCompare(lazyRowTuple((LazyObject*)self), other, op);
+}
+
+static Py_hash_t lazyRowHash(PyObject* self)
+{
+    PyObject* tuple = lazyRowTuple((LazyObject*)self);
+    const Py_hash_t hash = PyObject_Hash(tuple);
+    Py_DECREF(tuple);
+    return hash;
+}
+
+static bool samePlan(const TypeNode* node, const LazyObject* lazy)
+{
+    if (node->size - 1 != lazy->nodeCount) {
+        return false;
+    }
+    for (i32 i = 0; i < lazy->nodeCount; i++) {
+        const TypeNode* expected = node + 1 + i;
+        const TypeNode* actual = lazy->nodes + i;
+        if (expected->type != actual->type || expected->count != actual->count ||
+            expected->precision != actual->precision || expected->scale != actual->scale) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// an unmodified proxy for a value of the same type is encoded by copying its data
+static bool encodeLazy(const TypeNode* node, PyObject* input, Buffer* buffer)
+{
+    LazyObject* lazy = (LazyObject*)input;
+    if (lazy->list == NULL && samePlan(node, lazy)) {
+        if (node->type != ROW) {
+            bufferAppendI32(buffer, lazy->count);
+        }
+        bufferAppend(buffer, (const u8*)PyBytes_AS_STRING(lazy->data), PyBytes_GET_SIZE(lazy->data));
+        return true;
+    }
+    PyObject* value = node->type == MAP ? lazyMapToDict(lazy) : node->type == ARRAY ? lazyArrayValue(lazy) : lazyRowTuple(lazy);
+    if (value == NULL) {
+        resultError(input, node->type == MAP ? "MAP" : node->type == ARRAY ? "ARRAY" : "ROW");
+        return false;
+    }
+    const bool success = node->encode(node, value, buffer);
+    Py_DECREF(value);
+    return success;
+}
+
+static PyMappingMethods lazyMapMappingMethods = {
+    .mp_length = lazyMapLength,
+    .mp_subscript = lazyMapSubscript,
+};
+
+static PySequenceMethods lazyMapSequenceMethods = {
+    .sq_contains = lazyMapContains,
+};
+
+static PyMethodDef lazyMapMethods[] = {
+    {"get", (PyCFunction)(void (*)(void))lazyMapGet, METH_FASTCALL, NULL},
+    {NULL},
+};
+
+static PyTypeObject lazyMapType = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    .tp_name = "_pyhost.LazyMap",
+    .tp_basicsize = sizeof(LazyObject),
+    .tp_dealloc = lazyDealloc,
+    .tp_repr = lazyMapRepr,
+    .tp_as_sequence = &lazyMapSequenceMethods,
+    .tp_as_mapping = &lazyMapMappingMethods,
+    .tp_flags = Py_TPFLAGS_DEFAULT | Py_TPFLAGS_BASETYPE | Py_TPFLAGS_MAPPING,
+    .tp_iter = lazyMapIter,
+    .tp_methods = lazyMapMethods,
+};
+
+static PyMappingMethods lazyArrayMappingMethods = {
+    .mp_length = lazyArrayLength,
+    .mp_subscript = lazyArraySubscript,
+    .mp_ass_subscript = lazyArrayAssignSubscript,
+};
+
+static PySequenceMethods lazyArraySequenceMethods = {
+    .sq_length = lazyArrayLength,
+    .sq_item = lazyArrayGetItem,
+    .sq_contains = lazyArrayContains,
+};
+
+static PyMethodDef lazyArrayMethods[] = {
+    {"insert", (PyCFunction)(void (*)(void))lazyArrayInsert, METH_FASTCALL, NULL},
+    {NULL},
+};
+
+// only arrays hold references to other Python objects, once mutated
+static PyTypeObject lazyArrayType = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    .tp_name = "_pyhost.LazyArray",
+    .tp_basicsize = sizeof(LazyObject),
+    .tp_dealloc = lazyArrayDealloc,
+    .tp_repr = lazyArrayRepr,
+    .tp_as_sequence = &lazyArraySequenceMethods,
+    .tp_as_mapping = &lazyArrayMappingMethods,
+    .tp_hash = PyObject_HashNotImplemented,
+    .tp_flags = Py_TPFLAGS_DEFAULT | Py_TPFLAGS_BASETYPE | Py_TPFLAGS_HAVE_GC | Py_TPFLAGS_SEQUENCE,
+    .tp_traverse = lazyTraverse,
+    .tp_clear = lazyClear,
+    .tp_richcompare = lazyArrayCompare,
+    .tp_iter = lazyArrayIter,
+    .tp_methods = lazyArrayMethods,
+};
+
+static PyMappingMethods lazyRowMappingMethods = {
+    .mp_length = lazyRowLength,
+    .mp_subscript = lazyRowSubscript,
+};
+
+static PySequenceMethods lazyRowSequenceMethods = {
+    .sq_length = lazyRowLength,
+    .sq_item = lazyRowGetItem,
+};
+
+static PyTypeObject lazyRowType = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    .tp_name = "_pyhost.LazyRow",
+    .tp_basicsize = sizeof(LazyObject),
+    .tp_dealloc = lazyDealloc,
+    .tp_repr = lazyRowRepr,
+    .tp_as_sequence = &lazyRowSequenceMethods,
+    .tp_as_mapping = &lazyRowMappingMethods,
+    .tp_hash = lazyRowHash,
+    .tp_flags = Py_TPFLAGS_DEFAULT | Py_TPFLAGS_BASETYPE | Py_TPFLAGS_SEQUENCE,
+    .tp_richcompare = lazyRowCompare,
+    .tp_iter = lazyRowIter,
+};
+
+// reads the next chunk of a streamed argument into a writable buffer, and
+// returns the number of bytes read, which is zero at the end of the value
+static PyObject* pyhostReadChunk(PyObject* module, PyObject* const* args, const Py_ssize_t nargs)
+{
+    (void)module;
+    if (nargs != 2) {
+        PyErr_Format(PyExc_TypeError, "read_chunk expected 2 arguments, got %zd", nargs);
+        return NULL;
+    }
+    const int stream = PyLong_AsInt(args[0]);
+    if (stream == -1 && PyErr_Occurred()) {
+        return NULL;
+    }
+    Py_buffer buffer;
+    if (PyObject_GetBuffer(args[1], &buffer, PyBUF_WRITABLE) == -1) {
+        return NULL;
+    }
+    const i32 capacity = buffer.len > INT32_MAX ? INT32_MAX : (i32)buffer.len;
+    const i32 size = trinoReadChunk(stream, buffer.buf, capacity);
+    PyBuffer_Release(&buffer);
+    if (size < 0 || size > capacity) {
+        PyErr_Format(PyExc_OSError, "Failed to read chunk of argument stream %d", stream);
+        return NULL;
+    }
+    return PyLong_FromLong(size);
+}
+
+static PyMethodDef pyhostMethods[] = {
+    {"read_chunk", (PyCFunction)(void (*)(void))pyhostReadChunk, METH_FASTCALL, NULL},
+    {NULL},
+};
+
+static PyModuleDef pyhostModuleDef = {
+    PyModuleDef_HEAD_INIT,
+    .m_name = "_pyhost",
+    .m_size = -1,
+    .m_methods = pyhostMethods,
+};
+
+// built-in module with the types and functions the host provides for guest arguments
+static PyObject* initPyhostModule()
+{
+    static const struct
+    {
+        const char* name;
+        PyTypeObject* type;
+    } types[] = {
+        {"LazyMap", &lazyMapType},
+        {"LazyArray", &lazyArrayType},
+        {"LazyRow", &lazyRowType},
+    };
+
+    PyObject* module = PyModule_Create(&pyhostModuleDef);
+    if (module == NULL) {
+        return NULL;
+    }
+    for (size_t i = 0; i < sizeof(types) / sizeof(types[0]); i++) {
+        if (PyType_Ready(types[i].type) < 0 || PyModule_AddObjectRef(module, types[i].name, (PyObject*)types[i].type) < 0) {
+            Py_DECREF(module);
+            return NULL;
+        }
+    }
+    return module;
+}
+
+static void compileType(const u8** const type, TypePlan* plan)
+{
+    const TrinoType trinoType = readI32(type);
+    DEBUG("compileType: type=%d", trinoType);
+    if ((u32)trinoType >= sizeof(converters) / sizeof(converters[0])) {
+        FATAL("Unsupported Trino type %d", trinoType);
+    }
+
+    if (plan->count == plan->capacity) {
+        plan->capacity = plan->capacity == 0 ? 8 : plan->capacity * 2;
+        plan->nodes = xrealloc(plan->nodes, plan->capacity * sizeof(TypeNode));
+    }
+    const i32 index = plan->count++;
+    plan->nodes[index] = (TypeNode){
+        .type = trinoType,
+        .width = fixedWidth(trinoType),
+        .decode = converters[trinoType].decode,
+        .encode = converters[trinoType].encode,
+    };
+
+    switch (trinoType) {
+        case ROW: {
+            const i32 count = readI32(type);
+            plan->nodes[index].count = count;
+            for (i32 i = 0; i < count; i++) {
+                compileType(type, plan);
+            }
+            break;
+        }
+        case ARRAY:
+            compileType(type, plan);
+            break;
+        case MAP:
+            compileType(type, plan);
+            compileType(type, plan);
+            break;
+        case UNSCALED_DECIMAL: {
+            const i32 precision = readI32(type);
+            const i32 scale = readI32(type);
+            if (precision < 1 || precision > MAX_DECIMAL_PRECISION || scale < 0 || scale > precision) {
+                FATAL("Invalid DECIMAL(%d, %d)", precision, scale);
+            }
+            plan->nodes[index].precision = precision;
+            plan->nodes[index].scale = scale;
+            plan->nodes[index].width = precision <= MAX_SHORT_DECIMAL_PRECISION ? sizeof(i64) : sizeof(i128);
+            break;
+        }
+        default:
+            break;
+    }
+
+    plan->nodes[index].size = plan->count - index;
+}
+
+static void compilePlan(const u8* type, TypePlan* plan)
+{
+    plan->count = 0;
+    compileType(&type, plan);
+}
+
+// Result cache of memoized functions, mapping encoded argument records to
+// encoded result records. It is an open addressing table with linear probing,
+// bounded in bytes and evicted in CLOCK order, where a hit marks the entry as
+// referenced so that the next sweep of the hand spares it.
+typedef struct
+{
+    u64 hash;
+    i32 keySize;
+    i32 resultSize;
+    bool referenced;
+    u8 data[]; // the key followed by the result
+} CacheEntry;
+
+typedef struct
+{
+    CacheEntry** slots;
+    i32 capacity; // a power of two
+    i32 hand;
+    i64 maxBytes;
+    CacheStats stats;
+} ResultCache;
+
+static const i32 CACHE_INITIAL_CAPACITY = 64;
+
+static u64 hashBytes(const u8* data, const i32 size)
+{
+    u64 hash = 0x9E3779B97F4A7C15ULL ^ (u64)size;
+    i32 i = 0;
+    for (; i + 8 <= size; i += 8) {
+        u64 word;
+        memcpy(&word, data + i, sizeof(word));
+        hash = (hash ^ word) * 0xBF58476D1CE4E5B9ULL;
+        hash ^= hash >> 31;
+    }
+    u64 tail = 0;
+    memcpy(&tail, data + i, size - i);
+    hash = (hash ^ tail) * 0x94D049BB133111EBULL;
+    return hash ^ (hash >> 29);
+}
+
+static CacheEntry** newCacheSlots(const i32 capacity)
+{
+    CacheEntry** slots = calloc(capacity, sizeof(CacheEntry*));
+    if (slots == NULL) {
+        FATAL("Failed to allocate %d result cache slots", capacity);
+    }
+    return slots;
+}
+
+static ResultCache* newResultCache(const i64 maxBytes)
+{
+    ResultCache* cache = xrealloc(NULL, sizeof(ResultCache));
+    *cache = (ResultCache){
+        .slots = newCacheSlots(CACHE_INITIAL_CAPACITY),
+        .capacity = CACHE_INITIAL_CAPACITY,
+        .maxBytes = maxBytes,
+    };
+    return cache;
+}
+
+static void freeResultCache(ResultCache* cache)
+{
+    if (cache == NULL) {
+        return;
+    }
+    for (i32 i = 0; i < cache->capacity; i++) {
+        free(cache->slots[i]);
+    }
+    free(cache->slots);
+    free(cache);
+}
+
+static i32 cacheHome(const ResultCache* cache, const u64 hash)
+{
+    return hash & (cache->capacity - 1);
+}
+
+static const CacheEntry* cacheLookup(ResultCache* cache, const u64 hash, const u8* key, const i32 keySize)
+{
+    const i32 mask = cache->capacity - 1;
+    for (i32 slot = cacheHome(cache, hash); cache->slots[slot] != NULL; slot = (slot + 1) & mask) {
+        CacheEntry* entry = cache->slots[slot];
+        if (entry->hash == hash && entry->keySize == keySize && memcmp(entry->data, key, keySize) == 0) {
+            entry->referenced = true;
+            cache->stats.hits++;
+            return entry;
         }
-        case BIGINT: {
-            int overflow;
-            const i64 value = PyLong_AsLongLongAndOverflow(input, &overflow);
-            if (value == -1 && PyErr_Occurred()) {
-                resultError(input, "BIGINT");
-                return false;
+    }
+    cache->stats.misses++;
+    return NULL;
+}
+
+// removes the entry in the slot, shifting later entries of the probe run back
+// so that lookups never stop early at the hole
+static void cacheRemove(ResultCache* cache, i32 slot)
+{
+    const i32 mask = cache->capacity - 1;
+    CacheEntry* entry = cache->slots[slot];
+    cache->stats.entries--;
+    cache->stats.bytes -= sizeof(CacheEntry) + entry->keySize + entry->resultSize;
+    free(entry);
+    cache->slots[slot] = NULL;
+
+    for (i32 next = (slot + 1) & mask; cache->slots[next] != NULL; next = (next + 1) & mask) {
+        const i32 home = cacheHome(cache, cache->slots[next]->hash);
+        if (((next - home) & mask) >= ((next - slot) & mask)) {
+            cache->slots[slot] = cache->slots[next];
+            cache->slots[next] = NULL;
+            slot = next;
+        }
+    }
+}
+
+static void cacheEvict(ResultCache* cache)
+{
+    while (true) {
+        CacheEntry* entry = cache->slots[cache->hand];
+        if (entry != NULL && !entry->referenced) {
+            cacheRemove(cache, cache->hand);
+            cache->stats.evictions++;
+            return;
+        }
+        if (entry != NULL) {
+            entry->referenced = false;
+        }
+        cache->hand = (cache->hand + 1) & (cache->capacity - 1);
+    }
+}
+
+static void cachePlace(ResultCache* cache, CacheEntry* entry)
+{
+    i32 slot = cacheHome(cache, entry->hash);
+    while (cache->slots[slot] != NULL) {
+        slot = (slot + 1) & (cache->capacity - 1);
+    }
+    cache->slots[slot] = entry;
+}
+
+// the table is kept at most half full
+static void cacheGrow(ResultCache* cache)
+{
+    CacheEntry** slots = cache->slots;
+    const i32 capacity = cache->capacity;
+    cache->capacity = capacity * 2;
+    cache->slots = newCacheSlots(cache->capacity);
+    cache->hand = 0;
+    for (i32 i = 0; i < capacity; i++) {
+        if (slots[i] != NULL) {
+            cachePlace(cache, slots[i]);
+        }
+    }
+    free(slots);
+}
+
+static void cacheInsert(
+    ResultCache* cache, const u64 hash, const u8* key, const i32 keySize, const u8* result, const i32 resultSize)
+{
+    const i64 size = sizeof(CacheEntry) + keySize + resultSize;
+    if (size > cache->maxBytes) {
+        return;
+    }
+    while (cache->stats.bytes + size > cache->maxBytes) {
+        cacheEvict(cache);
+    }
+    if ((cache->stats.entries + 1) * 2 > cache->capacity) {
+        cacheGrow(cache);
+    }
+
+    CacheEntry* entry = xrealloc(NULL, size);
+    entry->hash = hash;
+    entry->keySize = keySize;
+    entry->resultSize = resultSize;
+    entry->referenced = false;
+    memcpy(entry->data, key, keySize);
+    memcpy(entry->data + keySize, result, resultSize);
+    cachePlace(cache, entry);
+    cache->stats.entries++;
+    cache->stats.bytes += size;
+}
+
+// a guest function registered by setup, identified by its table index
+struct GuestFunction
+{
+    PyObject* callable;
+    TypePlan argPlan;
+    TypePlan returnPlan;
+    bool vectorized;
+    vectorcallfunc vectorcall; // of the callable, resolved once
+    // aggregate functions, whose callable is the input function
+    PyObject* createFunction;
+    PyObject* combineFunction;
+    PyObject* outputFunction;
+    TypePlan statePlan;
+    ResultCache* cache; // for functions declared with trino.memoize
+    i32 chunkedArguments; // bit set of the arguments declared with trino.chunked
+};
+
+// Functions registered by setup. Those registered before the checkpoint are
+// kept by reset, later ones are released.
+typedef struct
+{
+    GuestFunction* functions;
+    i32 count;
+    i32 capacity;
+    i32 lastHandle; // used by the entry points that do not take a handle
+    i32 checkpointCount;
+    i32 checkpointLastHandle;
+} FunctionRegistry;
+
+static FunctionRegistry registry = {
+    .lastHandle = -1,
+    .checkpointCount = -1,
+    .checkpointLastHandle = -1,
+};
+
+static void selectGuest(const i32 handle)
+{
+    if (handle < 0 || handle >= registry.count) {
+        FATAL("Invalid function handle %d", handle);
+    }
+    call.guest = &registry.functions[handle];
+}
+
+static void selectScalar(const i32 handle)
+{
+    selectGuest(handle);
+    if (call.guest->createFunction != NULL) {
+        FATAL("Function handle %d is an aggregate function", handle);
+    }
+}
+
+static void selectAggregate(const i32 handle)
+{
+    selectGuest(handle);
+    if (call.guest->createFunction == NULL) {
+        FATAL("Function handle %d is not an aggregate function", handle);
+    }
+}
+
+static const struct
+{
+    const char* format;
+    const char* name;
+} vectorTypes[] = {
+    [BOOLEAN] = {"?", "BOOLEAN"},
+    [BIGINT] = {"q", "BIGINT"},
+    [INTEGER] = {"i", "INTEGER"},
+    [SMALLINT] = {"h", "SMALLINT"},
+    [TINYINT] = {"b", "TINYINT"},
+    [DOUBLE] = {"d", "DOUBLE"},
+    [REAL] = {"f", "REAL"},
+};
+
+static bool isVectorType(const TypeNode* node)
+{
+    return (u32)node->type < sizeof(vectorTypes) / sizeof(vectorTypes[0]) &&
+           vectorTypes[node->type].format != NULL;
+}
+
+// vectorized functions take and return columns of fixed width numeric values
+static bool isVectorSignature()
+{
+    const TypeNode* node = call.guest->argPlan.nodes;
+    if (node->type != ROW || !isVectorType(call.guest->returnPlan.nodes)) {
+        return false;
+    }
+    const TypeNode* field = node + 1;
+    for (i32 i = 0; i < node->count; i++) {
+        if (!isVectorType(field)) {
+            return false;
+        }
+        field = nextSibling(field);
+    }
+    return true;
+}
+
+static char formatKind(const char format)
+{
+    switch (format) {
+        case 'b':
+        case 'h':
+        case 'i':
+        case 'l':
+        case 'q':
+        case 'n':
+            return 'i';
+        case 'f':
+        case 'd':
+            return 'f';
+        default:
+            return format;
+    }
+}
+
+static bool formatMatches(const TypeNode* node, const Py_buffer* view)
+{
+    const char* format = view->format == NULL ? "B" : view->format;
+    if (*format == '@' || *format == '=' || *format == '<') {
+        format++;
+    }
+    return view->itemsize == node->width &&
+           format[0] != '\0' && format[1] == '\0' &&
+           formatKind(format[0]) == formatKind(vectorTypes[node->type].format[0]);
+}
+
+static i64 functionIntOption(PyObject* function, const char* name)
+{
+    PyObject* value;
+    if (PyObject_GetOptionalAttrString(function, name, &value) == -1) {
+        PyErr_Print();
+        FATAL("Failed to get function attribute '%s'", name);
+    }
+    if (value == NULL) {
+        return 0;
+    }
+    const i64 result = PyLong_AsLongLong(value);
+    Py_DECREF(value);
+    if (result == -1 && PyErr_Occurred()) {
+        PyErr_Print();
+        FATAL("Failed to get function attribute '%s'", name);
+    }
+    return result;
+}
+
+static bool functionOption(PyObject* function, const char* name)
+{
+    PyObject* value;
+    if (PyObject_GetOptionalAttrString(function, name, &value) == -1) {
+        PyErr_Print();
+        FATAL("Failed to get function attribute '%s'", name);
+    }
+    if (value == NULL) {
+        return false;
+    }
+    const int result = PyObject_IsTrue(value);
+    Py_DECREF(value);
+    if (result == -1) {
+        PyErr_Print();
+        FATAL("Failed to get function attribute '%s'", name);
+    }
+    return result;
+}
+
+// Tracebacks are formatted for the first limit errors after it was
+// last set, or for all errors when negative. The most recent exception is
+// kept so that its traceback can still be requested through last_traceback.
+typedef struct
+{
+    i32 limit;
+    i32 count;
+    PyObject* lastException;
+} TracebackState;
+
+static TracebackState tracebacks = {.limit = -1};
+
+static PyObject* formatTraceback(PyObject* exception)
+{
+    PyObject* traceback = PyObject_CallOneArg(host.formatTracebackFunction, exception);
+    if (traceback == NULL) {
+        if (PyErr_ExceptionMatches(PyExc_MemoryError)) {
+            return NULL;
+        }
+        PyErr_Print();
+        FATAL("Failed to format Python traceback");
+    }
+    return traceback;
+}
+
+// maps the exception to a Trino error in C, only calling into Python for the
+// exception string and an optional traceback
+static void handleTrinoError(PyObject* exception)
+{
+    if (exception == NULL) {
+        FATAL("Python exception not raised for function failure");
+    }
+    if (PyErr_GivenExceptionMatches(exception, PyExc_MemoryError)) {
+        memoryError();
+        return;
+    }
+    Py_XSETREF(tracebacks.lastException, Py_NewRef(exception));
+
+    PyObject* value = PyObject_Str(exception);
+    if (value == NULL) {
+        if (PyErr_ExceptionMatches(PyExc_MemoryError)) {
+            PyErr_Clear();
+            memoryError();
+            return;
+        }
+        PyErr_Print();
+        FATAL("Failed to convert Python exception to string");
+    }
+    Py_ssize_t valueSize;
+    const char* valueString = PyUnicode_AsUTF8AndSize(value, &valueSize);
+    if (valueString == NULL) {
+        PyErr_Print();
+        FATAL("Failed to get Python exception string");
+    }
+
+    i32 errorCode = FUNCTION_IMPLEMENTATION_ERROR;
+    const char* message = valueString;
+    i32 messageSize = valueSize;
+    if (PyErr_GivenExceptionMatches(exception, host.trinoErrorClass)) {
+        PyObject* errorCodeObject = PyObject_GetAttrString(exception, "error_code");
+        errorCode = errorCodeObject == NULL ? -1 : PyLong_AsLong(errorCodeObject);
+        if (errorCode == -1 && PyErr_Occurred()) {
+            PyErr_Print();
+            FATAL("Failed to get error code from Trino error");
+        }
+        Py_DECREF(errorCodeObject);
+    }
+    else if (PyErr_GivenExceptionMatches(exception, PyExc_ZeroDivisionError)) {
+        errorCode = DIVISION_BY_ZERO;
+    }
+    else {
+        const char* typeName = Py_TYPE(exception)->tp_name;
+        messageSize = valueSize == 0
+            ? formatErrorMessage("%s", typeName)
+            : formatErrorMessage("%s: %s", typeName, valueString);
+        message = errorMessage;
+    }
+
+    PyObject* traceback = NULL;
+    const char* tracebackString = NULL;
+    Py_ssize_t tracebackSize = 0;
+    if (tracebacks.limit < 0 || tracebacks.count < tracebacks.limit) {
+        tracebacks.count++;
+        traceback = formatTraceback(exception);
+        tracebackString = traceback == NULL ? NULL : PyUnicode_AsUTF8AndSize(traceback, &tracebackSize);
+        if (tracebackString == NULL) {
+            PyErr_Clear();
+            tracebackSize = 0;
+        }
+    }
+
+    returnError(errorCode, message, messageSize, tracebackString, tracebackSize);
+    Py_XDECREF(traceback);
+    Py_DECREF(value);
+}
+
+u8* allocate(const i32 size)
+{
+    return xrealloc(NULL, size);
+}
+
+void deallocate(u8* pointer)
+{
+    return free(pointer);
+}
+
+static PyObject* loadGuestModule()
+{
+    static bool guestPathAdded = false;
+    if (!guestPathAdded) {
+        PyObject* path = PySys_GetObject("path");
+        PyObject* entry = PyUnicode_FromString("/guest");
+        PyList_Append(path, entry);
+        Py_DECREF(entry);
+        guestPathAdded = true;
+    }
+    return loadModule("guest");
+}
+
+// Collects garbage and moves the remaining objects into the permanent
+// generation, which later collections skip, so they neither traverse the
+// snapshot objects nor write their GC headers. Reference counting still
+// writes to every mortal object a call touches.
+static void freezeHeap()
+{
+    PyGC_Collect();
+    PyObject* gc = checked(PyImport_ImportModule("gc"));
+    Py_DECREF(checked(PyObject_CallMethod(gc, "freeze", NULL)));
+    Py_DECREF(gc);
+}
+
+void initializeGuest()
+{
+    DEBUG("initializeGuest()");
+    PyObject* module = loadGuestModule();
+
+    // resolve the declared functions so a missing one fails the build
+    const char* functions = getenv("TRINO_GUEST_FUNCTIONS");
+    if (functions != NULL) {
+        char* list = strdup(functions);
+        if (list == NULL) {
+            FATAL("Failed to allocate memory for guest function list");
+        }
+        for (char* name = strtok(list, ","); name != NULL; name = strtok(NULL, ",")) {
+            Py_DECREF(findFunction(module, name));
+            DEBUG("Resolved guest function '%s'", name);
+        }
+        free(list);
+    }
+    Py_DECREF(module);
+
+    // keep import garbage out of the snapshot
+    freezeHeap();
+    DEBUG("Guest initialized");
+}
+
+static i32 newGuestFunction()
+{
+    if (registry.count == registry.capacity) {
+        registry.capacity = registry.capacity == 0 ? 4 : registry.capacity * 2;
+        registry.functions = xrealloc(registry.functions, registry.capacity * sizeof(GuestFunction));
+    }
+    const i32 handle = registry.count++;
+    call.guest = &registry.functions[handle];
+    *call.guest = (GuestFunction){0};
+    return handle;
+}
+
+// argument decoding options set by the trino.zero_copy and trino.lazy decorators
+// arguments past this position are passed in full, so the bit set fits an i32
+#define MAX_CHUNKED_ARGUMENTS 31
+
+static void applyArgumentOptions(PyObject* function)
+{
+    const i64 chunked = functionIntOption(function, "__trino_chunked__");
+    if (chunked != 0) {
+        // only top level fields of the argument row, which are unpacked for the call
+        const TypeNode* root = call.guest->argPlan.nodes;
+        TypeNode* field = &call.guest->argPlan.nodes[1];
+        for (i32 i = 0; i < root->count && i < MAX_CHUNKED_ARGUMENTS; i++) {
+            if ((chunked & ((i64)1 << i)) != 0 && (field->type == VARCHAR || field->type == VARBINARY)) {
+                field->decode = decodeChunkedArgument;
+                call.guest->chunkedArguments |= 1 << i;
             }
-            if (overflow) {
-                overflowError("Value out of range for BIGINT");
-                return false;
+            field += field->size;
+        }
+    }
+
+    // streamed fields hold a stream id instead of the value, so the other
+    // options leave their decoders in place
+    if (functionOption(function, "__trino_zero_copy__")) {
+        const bool varchar = functionOption(function, "__trino_zero_copy_varchar__");
+        for (i32 i = 0; i < call.guest->argPlan.count; i++) {
+            TypeNode* node = &call.guest->argPlan.nodes[i];
+            if (node->decode == decodeChunkedArgument) {
+                continue;
+            }
+            if (node->type == VARBINARY || (varchar && node->type == VARCHAR)) {
+                node->decode = decodeArgumentView;
             }
-            bufferAppendI64(buffer, value);
-            return true;
         }
-        case INTEGER: {
-            int overflow;
-            const i32 value = PyLong_AsLongAndOverflow(input, &overflow);
-            if (value == -1 && PyErr_Occurred()) {
-                resultError(input, "INTEGER");
-                return false;
+    }
+
+    if (functionOption(function, "__trino_lazy__")) {
+        const bool maps = functionOption(function, "__trino_lazy_maps__");
+        const bool arrays = functionOption(function, "__trino_lazy_arrays__");
+        const bool rows = functionOption(function, "__trino_lazy_rows__");
+        // the root is the argument row, which is unpacked for the call
+        for (i32 i = 1; i < call.guest->argPlan.count; i++) {
+            TypeNode* node = &call.guest->argPlan.nodes[i];
+            if (node->decode == decodeChunkedArgument) {
+                continue;
             }
-            if (overflow) {
-                overflowError("Value out of range for INTEGER");
-                return false;
+            if (maps && node->type == MAP) {
+                node->decode = decodeLazyMap;
             }
-            bufferAppendI32(buffer, value);
-            return true;
+            else if (arrays && node->type == ARRAY) {
+                node->decode = decodeLazyArray;
+            }
+            else if (rows && node->type == ROW) {
+                node->decode = decodeLazyRow;
+            }
+        }
+    }
+}
+
+static PyObject* optionalAttribute(PyObject* object, const char* name)
+{
+    PyObject* value;
+    if (PyObject_GetOptionalAttrString(object, name, &value) == -1) {
+        PyErr_Print();
+        FATAL("Failed to get attribute '%s'", name);
+    }
+    return value;
+}
+
+// Selects the exact type encoders for the parts of the plan that the hint
+// declares with builtin types, such as list[int] or dict[str, float]. Hints
+// that do not match the Trino type are ignored.
+static void applyResultHint(TypeNode* node, PyObject* hint)
+{
+    PyObject* origin = optionalAttribute(hint, "__origin__");
+    PyObject* args = optionalAttribute(hint, "__args__");
+    if (args != NULL && !PyTuple_Check(args)) {
+        Py_CLEAR(args);
+    }
+    const Py_ssize_t argCount = args == NULL ? 0 : PyTuple_GET_SIZE(args);
+    PyObject* type = origin != NULL ? origin : hint;
+
+    if (type == (PyObject*)exactEncoders[node->type].hint) {
+        node->encode = exactEncoders[node->type].encode;
+        if (node->type == ARRAY && argCount == 1) {
+            applyResultHint(node + 1, PyTuple_GET_ITEM(args, 0));
+        }
+        else if (node->type == MAP && argCount == 2) {
+            TypeNode* keyNode = node + 1;
+            applyResultHint(keyNode, PyTuple_GET_ITEM(args, 0));
+            applyResultHint(keyNode + keyNode->size, PyTuple_GET_ITEM(args, 1));
+        }
+        else if (node->type == ROW && argCount == node->count) {
+            TypeNode* field = node + 1;
+            for (i32 i = 0; i < node->count; i++) {
+                applyResultHint(field, PyTuple_GET_ITEM(args, i));
+                field += field->size;
+            }
+        }
+    }
+    else if (argCount == 2 && (origin == NULL || !PyType_Check(origin))) {
+        // X | None and Optional[X], as nulls are encoded before the encoder is called
+        PyObject* noneType = (PyObject*)Py_TYPE(Py_None);
+        if (PyTuple_GET_ITEM(args, 1) == noneType) {
+            applyResultHint(node, PyTuple_GET_ITEM(args, 0));
+        }
+        else if (PyTuple_GET_ITEM(args, 0) == noneType) {
+            applyResultHint(node, PyTuple_GET_ITEM(args, 1));
+        }
+    }
+
+    Py_XDECREF(origin);
+    Py_XDECREF(args);
+}
+
+// the hint declared with trino.returns, or else the return annotation
+static void applyResultHints(PyObject* function, TypePlan* plan)
+{
+    PyObject* hint = optionalAttribute(function, "__trino_returns__");
+    if (hint == NULL) {
+        PyObject* annotations = optionalAttribute(function, "__annotations__");
+        if (annotations != NULL && PyDict_Check(annotations) &&
+            PyDict_GetItemStringRef(annotations, "return", &hint) == -1) {
+            PyErr_Print();
+            FATAL("Failed to get return annotation");
+        }
+        Py_XDECREF(annotations);
+    }
+    if (hint != NULL) {
+        applyResultHint(plan->nodes, hint);
+        Py_DECREF(hint);
+    }
+}
+
+i32 setup(const u8* functionName, const u8* argType, const u8* returnType)
+{
+    const char* name = (const char*)functionName;
+    DEBUG("setup('%s')", name);
+
+    const i32 handle = newGuestFunction();
+    call.guest->callable = findFunction(loadGuestModule(), name);
+    call.guest->vectorcall = PyVectorcall_Function(call.guest->callable);
+
+    compilePlan(argType, &call.guest->argPlan);
+    compilePlan(returnType, &call.guest->returnPlan);
+    if (call.guest->argPlan.nodes->type != ROW) {
+        FATAL("Function '%s' requires a ROW argument type", name);
+    }
+    applyArgumentOptions(call.guest->callable);
+
+    call.guest->vectorized = functionOption(call.guest->callable, "__trino_vectorized__");
+    if (call.guest->vectorized && !isVectorSignature()) {
+        FATAL("Vectorized function '%s' requires fixed width numeric argument and return types", name);
+    }
+    if (!call.guest->vectorized) {
+        applyResultHints(call.guest->callable, &call.guest->returnPlan);
+    }
+
+    const i64 cacheBytes = functionIntOption(call.guest->callable, "__trino_memoize__");
+    // streamed arguments are encoded as stream ids, which cannot be cache keys
+    if (cacheBytes > 0 && call.guest->chunkedArguments == 0) {
+        call.guest->cache = newResultCache(cacheBytes);
+    }
+
+    registry.lastHandle = handle;
+    DEBUG("Setup complete: handle=%d", handle);
+    return handle;
+}
+
+static PyObject* findAggregateFunction(PyObject* aggregate, const char* aggregateName, const char* name)
+{
+    PyObject* function = PyObject_GetAttrString(aggregate, name);
+    if (function == NULL || !PyCallable_Check(function)) {
+        if (PyErr_Occurred()) {
+            PyErr_Print();
+        }
+        FATAL("Cannot find function '%s' of aggregate '%s'", name, aggregateName);
+    }
+    return function;
+}
+
+i32 setupAggregate(const u8* aggregateName, const u8* argType, const u8* stateType, const u8* returnType)
+{
+    const char* name = (const char*)aggregateName;
+    DEBUG("setupAggregate('%s')", name);
+
+    const i32 handle = newGuestFunction();
+    PyObject* aggregate = PyObject_GetAttrString(loadGuestModule(), name);
+    if (aggregate == NULL) {
+        PyErr_Print();
+        FATAL("Cannot find aggregate '%s' in 'guest'", name);
+    }
+    call.guest->createFunction = findAggregateFunction(aggregate, name, "create");
+    call.guest->callable = findAggregateFunction(aggregate, name, "input");
+    call.guest->vectorcall = PyVectorcall_Function(call.guest->callable);
+    call.guest->combineFunction = findAggregateFunction(aggregate, name, "combine");
+    call.guest->outputFunction = findAggregateFunction(aggregate, name, "output");
+    Py_DECREF(aggregate);
+
+    compilePlan(argType, &call.guest->argPlan);
+    compilePlan(stateType, &call.guest->statePlan);
+    compilePlan(returnType, &call.guest->returnPlan);
+    if (call.guest->argPlan.nodes->type != ROW) {
+        FATAL("Aggregate '%s' requires a ROW argument type", name);
+    }
+    applyArgumentOptions(call.guest->callable);
+    applyResultHints(call.guest->outputFunction, &call.guest->returnPlan);
+
+    DEBUG("Setup complete: handle=%d", handle);
+    return handle;
+}
+
+static Buffer newResultBuffer()
+{
+    return (Buffer){
+        .data = xrealloc(NULL, 1024),
+        .size = 1024,
+        .used = 4,
+    };
+}
+
+static u8* finishResultBuffer(Buffer* buffer)
+{
+    *(i32*)buffer->data = buffer->used - 4;
+    return buffer->data;
+}
+
+static const i32 ARENA_INITIAL_SIZE = 64 * 1024;
+static const i32 ARENA_RETAIN_LIMIT = 4 * 1024 * 1024;
+static const i32 ARENA_SHRINK_INTERVAL = 64;
+
+static ResultArena arena;
+static i32 arenaLastUsed;
+static i32 arenaPeak;
+static i32 arenaCalls;
+
+static i32 arenaSizeFor(const i32 used)
+{
+    i32 size = ARENA_INITIAL_SIZE;
+    while (size < used) {
+        size *= 2;
+    }
+    return size;
+}
+
+// Shrink the arena if it is far larger than recent results need. A result
+// above the retain limit is released on the next call, while smaller growth
+// is only given back after a whole interval of smaller results.
+static void arenaShrink()
+{
+    i32 target = arena.capacity;
+    if (arena.capacity > ARENA_RETAIN_LIMIT && arenaLastUsed * 2 < arena.capacity) {
+        target = arenaSizeFor(arenaLastUsed);
+    }
+    else if (++arenaCalls >= ARENA_SHRINK_INTERVAL) {
+        if (arenaPeak * 2 < arena.capacity) {
+            target = arenaSizeFor(arenaPeak);
         }
-        case SMALLINT: {
-            int overflow;
-            const i32 value = PyLong_AsLongAndOverflow(input, &overflow);
-            if (value == -1 && PyErr_Occurred()) {
-                resultError(input, "SMALLINT");
-                return false;
-            }
-            if (overflow || value < INT16_MIN || value > INT16_MAX) {
-                overflowError("Value out of range for SMALLINT");
-                return false;
-            }
-            bufferAppendI16(buffer, value);
-            return true;
+        arenaCalls = 0;
+        arenaPeak = 0;
+    }
+    if (target < arena.capacity) {
+        DEBUG("arenaShrink: %d -> %d", arena.capacity, target);
+        arena.data = xrealloc(arena.data, target);
+        arena.capacity = target;
+    }
+}
+
+static Buffer arenaBuffer()
+{
+    if (arena.data == NULL) {
+        arena.data = xrealloc(NULL, ARENA_INITIAL_SIZE);
+        arena.capacity = ARENA_INITIAL_SIZE;
+    }
+    else {
+        arenaShrink();
+    }
+    return (Buffer){
+        .data = arena.data,
+        .size = arena.capacity,
+        .used = 4,
+    };
+}
+
+static void arenaRelease(Buffer* buffer)
+{
+    arena.data = buffer->data;
+    arena.capacity = buffer->size;
+    arenaLastUsed = buffer->used;
+    if (arenaPeak < buffer->used) {
+        arenaPeak = buffer->used;
+    }
+}
+
+static u8* finishArenaBuffer(Buffer* buffer)
+{
+    arenaRelease(buffer);
+    return finishResultBuffer(buffer);
+}
+
+const ResultArena* resultArena()
+{
+    return &arena;
+}
+
+void setTracebackLimit(const i32 limit)
+{
+    tracebacks.limit = limit;
+    tracebacks.count = 0;
+}
+
+u8* lastTraceback()
+{
+    if (tracebacks.lastException == NULL) {
+        return NULL;
+    }
+    PyObject* traceback = formatTraceback(tracebacks.lastException);
+    if (traceback == NULL) {
+        PyErr_Clear();
+        return NULL;
+    }
+    Py_ssize_t size;
+    const char* string = PyUnicode_AsUTF8AndSize(traceback, &size);
+    if (string == NULL) {
+        PyErr_Clear();
+        size = 0;
+    }
+    Buffer buffer = newResultBuffer();
+    bufferAppend(&buffer, (const u8*)string, size);
+    Py_DECREF(traceback);
+    return finishResultBuffer(&buffer);
+}
+
+i32 getStats(u8* out)
+{
+    memcpy(out, &stats, sizeof(stats));
+    return sizeof(stats);
+}
+
+i32 getCacheStats(const i32 handle, u8* out)
+{
+    selectGuest(handle);
+    if (call.guest->cache == NULL) {
+        return 0;
+    }
+    memcpy(out, &call.guest->cache->stats, sizeof(CacheStats));
+    return sizeof(CacheStats);
+}
+
+i32 chunkedArguments(const i32 handle)
+{
+    selectGuest(handle);
+    return call.guest->chunkedArguments;
+}
+
+void resetStats()
+{
+    stats = (HostStats){
+        .version = HOST_STATS_VERSION,
+        .typeCount = TRINO_TYPE_COUNT,
+    };
+}
+
+// Profiler call tree. Node zero is the root, and each node is a function
+// called from its parent node, keyed by the code object or C function.
+typedef struct
+{
+    PyObject* function;
+    i32 parent;
+    i32 firstChild;
+    i32 nextSibling;
+    i64 calls;
+    i64 selfNanos;
+} ProfileNode;
+
+typedef struct
+{
+    i32 node; // or -1 when the call was not recorded
+    i64 start;
+    i64 childNanos;
+} ProfileFrame;
+
+#define PROFILE_MAX_NODES 4096
+#define PROFILE_MAX_DEPTH 256
+
+typedef struct
+{
+    ProfileNode* nodes;
+    i32 nodeCount;
+    ProfileFrame stack[PROFILE_MAX_DEPTH];
+    i32 depth;
+    i32 overflowDepth; // calls past the maximum depth that have not returned
+    bool active;
+} ProfilerState;
+
+static ProfilerState profiler;
+
+static void profileClear()
+{
+    for (i32 i = 1; i < profiler.nodeCount; i++) {
+        Py_DECREF(profiler.nodes[i].function);
+    }
+    profiler.nodeCount = 1;
+    profiler.nodes[0] = (ProfileNode){.parent = -1, .firstChild = -1, .nextSibling = -1};
+    profiler.depth = 0;
+    profiler.overflowDepth = 0;
+}
+
+// the child of parent for function, or -1 once the tree is full, in which
+// case the time of the call is included in the self time of the parent
+static i32 profileChild(const i32 parent, PyObject* function)
+{
+    for (i32 child = profiler.nodes[parent].firstChild; child != -1; child = profiler.nodes[child].nextSibling) {
+        if (profiler.nodes[child].function == function) {
+            return child;
         }
-        case TINYINT: {
-            int overflow;
-            const i32 value = PyLong_AsLongAndOverflow(input, &overflow);
-            if (value == -1 && PyErr_Occurred()) {
-                resultError(input, "TINYINT");
-                return false;
-            }
-            if (overflow || value < INT8_MIN || value > INT8_MAX) {
-                overflowError("Value out of range for TINYINT");
-                return false;
-            }
-            bufferAppendI8(buffer, value);
-            return true;
+    }
+    if (profiler.nodeCount == PROFILE_MAX_NODES) {
+        return -1;
+    }
+    const i32 child = profiler.nodeCount++;
+    profiler.nodes[child] = (ProfileNode){
+        .function = Py_NewRef(function),
+        .parent = parent,
+        .firstChild = -1,
+        .nextSibling = profiler.nodes[parent].firstChild,
+    };
+    profiler.nodes[parent].firstChild = child;
+    return child;
+}
+
+static void profileEnter(PyObject* function)
+{
+    if (profiler.depth == PROFILE_MAX_DEPTH) {
+        profiler.overflowDepth++;
+        return;
+    }
+    const i32 parent = profiler.depth == 0 ? 0 : profiler.stack[profiler.depth - 1].node;
+    const i32 node = parent == -1 ? -1 : profileChild(parent, function);
+    if (node != -1) {
+        profiler.nodes[node].calls++;
+    }
+    profiler.stack[profiler.depth++] = (ProfileFrame){.node = node, .start = clockNanos()};
+}
+
+static void profileExit()
+{
+    if (profiler.overflowDepth > 0) {
+        profiler.overflowDepth--;
+        return;
+    }
+    // returns from frames entered before profiling started
+    if (profiler.depth == 0) {
+        return;
+    }
+    const ProfileFrame* frame = &profiler.stack[--profiler.depth];
+    if (frame->node == -1) {
+        return;
+    }
+    const i64 elapsed = clockNanos() - frame->start;
+    profiler.nodes[frame->node].selfNanos += elapsed - frame->childNanos;
+    if (profiler.depth > 0) {
+        profiler.stack[profiler.depth - 1].childNanos += elapsed;
+    }
+}
+
+static int profileHook(PyObject* object, PyFrameObject* frame, const int what, PyObject* arg)
+{
+    (void)object;
+    switch (what) {
+        case PyTrace_CALL: {
+            PyCodeObject* code = PyFrame_GetCode(frame);
+            profileEnter((PyObject*)code);
+            Py_DECREF(code);
+            break;
         }
-        case DOUBLE: {
-            const f64 value = PyFloat_AsDouble(input);
-            if (value == -1.0 && PyErr_Occurred()) {
-                resultError(input, "DOUBLE");
-                return false;
-            }
-            bufferAppend(buffer, (u8*)&value, sizeof(f64));
-            return true;
+        case PyTrace_C_CALL:
+            profileEnter(arg);
+            break;
+        case PyTrace_RETURN:
+        case PyTrace_C_RETURN:
+        case PyTrace_C_EXCEPTION:
+            profileExit();
+            break;
+        default:
+            break;
+    }
+    return 0;
+}
+
+void profileStart()
+{
+    DEBUG("profileStart()");
+    if (profiler.nodes == NULL) {
+        profiler.nodes = xrealloc(NULL, PROFILE_MAX_NODES * sizeof(ProfileNode));
+        profiler.nodeCount = 1;
+    }
+    profileClear();
+    PyEval_SetProfile(profileHook, NULL);
+    profiler.active = true;
+}
+
+void profileStop()
+{
+    DEBUG("profileStop()");
+    PyEval_SetProfile(NULL, NULL);
+    profiler.active = false;
+}
+
+static void appendProfileLabel(Buffer* buffer, PyObject* function)
+{
+    PyObject* label;
+    if (PyCode_Check(function)) {
+        PyCodeObject* code = (PyCodeObject*)function;
+        label = PyUnicode_FromFormat("%U (%U:%d)", code->co_qualname, code->co_filename, code->co_firstlineno);
+    }
+    else {
+        PyObject* name = PyObject_GetAttrString(function, "__qualname__");
+        label = name == NULL ? NULL : PyUnicode_FromFormat("%S (built-in)", name);
+        Py_XDECREF(name);
+    }
+    Py_ssize_t size;
+    const char* text = label == NULL ? NULL : PyUnicode_AsUTF8AndSize(label, &size);
+    if (text == NULL) {
+        PyErr_Clear();
+        text = "?";
+        size = 1;
+    }
+    // frames are separated by semicolons in the collapsed format
+    for (Py_ssize_t i = 0; i < size; i++) {
+        bufferAppendI8(buffer, text[i] == ';' ? ':' : text[i]);
+    }
+    Py_XDECREF(label);
+}
+
+static void appendProfileStacks(Buffer* buffer, Buffer* path, const i32 node, const bool calls)
+{
+    const i32 pathUsed = path->used;
+    if (node != 0) {
+        if (path->used > 0) {
+            bufferAppendI8(path, ';');
         }
-        case REAL: {
-            const f32 value = PyFloat_AsDouble(input);
-            if (value == -1.0 && PyErr_Occurred()) {
-                resultError(input, "REAL");
-                return false;
-            }
-            bufferAppend(buffer, (u8*)&value, sizeof(f32));
-            return true;
+        appendProfileLabel(path, profiler.nodes[node].function);
+
+        const i64 value = calls ? profiler.nodes[node].calls : profiler.nodes[node].selfNanos / 1000;
+        if (value > 0) {
+            char count[24];
+            const int length = snprintf(count, sizeof(count), " %lld\n", (long long)value);
+            bufferAppend(buffer, path->data, path->used);
+            bufferAppend(buffer, (const u8*)count, length);
         }
-        case DECIMAL: {
-            PyObject* string = PyObject_CallOneArg(decimalToStringFunction, input);
-            if (string == NULL) {
-                resultError(input, "DECIMAL");
-                return false;
-            }
-            if (!bufferAppendString(buffer, string)) {
-                Py_DECREF(string);
-                resultError(input, "DECIMAL");
-                return false;
-            }
-            Py_DECREF(string);
+    }
+    for (i32 child = profiler.nodes[node].firstChild; child != -1; child = profiler.nodes[child].nextSibling) {
+        appendProfileStacks(buffer, path, child, calls);
+    }
+    path->used = pathUsed;
+}
+
+u8* profileDump(const i32 metric)
+{
+    DEBUG("profileDump(%d)", metric);
+    Buffer buffer = newResultBuffer();
+    if (profiler.nodes != NULL) {
+        Buffer path = {.data = xrealloc(NULL, 1024), .size = 1024};
+        appendProfileStacks(&buffer, &path, 0, metric == PROFILE_CALLS);
+        free(path.data);
+    }
+    return finishResultBuffer(&buffer);
+}
+
+// scratch space reused across calls
+typedef struct
+{
+    Buffer rowError;
+    Buffer errors;
+    Buffer dictionary;
+    PyObject** rows;
+    i32 rowsCapacity;
+} ScratchBuffers;
+
+static ScratchBuffers scratch;
+
+static Buffer* scratchBuffer(Buffer* buffer)
+{
+    if (buffer->data == NULL) {
+        buffer->data = xrealloc(NULL, 256);
+        buffer->size = 256;
+    }
+    buffer->used = 0;
+    return buffer;
+}
+
+static PyObject** scratchRows(const i32 count)
+{
+    if (scratch.rowsCapacity < count) {
+        scratch.rowsCapacity = count;
+        scratch.rows = xrealloc(scratch.rows, count * sizeof(PyObject*));
+    }
+    return scratch.rows;
+}
+
+// reports the exception raised by the guest
+static void guestError()
+{
+    const i64 start = clockNanos();
+    PyObject* exception = PyErr_GetRaisedException();
+    handleTrinoError(exception);
+    Py_DECREF(exception);
+    phaseEnd(&stats.error, start);
+}
+
+static PyObject* invokeGuestFunction(
+    PyObject* function, const vectorcallfunc vectorcall, PyObject* const* args, const i32 argCount)
+{
+#ifndef NDEBUG
+    for (i32 i = 0; i < argCount; i++) {
+        PyObject* str = PyObject_Repr(args[i]);
+        DEBUG("invoke: args[%d]=%s", i, PyUnicode_AsUTF8(str));
+        Py_DECREF(str);
+    }
+#endif
+
+    const i64 start = phaseSample(&stats.invoke);
+    PyObject* value = vectorcall != NULL
+        ? vectorcall(function, args, argCount, NULL)
+        : PyObject_Vectorcall(function, args, argCount, NULL);
+    if (value == NULL) {
+        guestError();
+    }
+    phaseSampleEnd(&stats.invoke, start);
+    return value;
+}
+
+static PyObject* invokeGuest(PyObject* const* args, const i32 argCount)
+{
+    return invokeGuestFunction(call.guest->callable, call.guest->vectorcall, args, argCount);
+}
+
+// arguments are passed from the stack, unless there are more than this
+#define STACK_ARGUMENTS 16
+
+static PyObject** argumentArray(PyObject** stack, const i32 count)
+{
+    return count <= STACK_ARGUMENTS ? stack : xrealloc(NULL, count * sizeof(PyObject*));
+}
+
+static void releaseArgumentArray(PyObject** args, const i32 count, PyObject** stack)
+{
+    for (i32 i = 0; i < count; i++) {
+        Py_DECREF(args[i]);
+    }
+    if (args != stack) {
+        free(args);
+    }
+}
+
+// decodes the fields of an argument record into args, without building the
+// tuple of the argument row
+static void decodeArguments(const u8** const data, PyObject** args)
+{
+    const TypeNode* node = call.guest->argPlan.nodes;
+    if (!readI8(data)) {
+        FATAL("Argument row must not be null");
+    }
+    stats.decodedValues[ROW]++;
+    const TypeNode* field = node + 1;
+    for (i32 i = 0; i < node->count; i++) {
+        args[i] = decodeField(field, data);
+        field = nextSibling(field);
+    }
+}
+
+static void retainedViewError()
+{
+    const char* message = "Function retained a buffer exported from an argument memoryview";
+    returnError(FUNCTION_IMPLEMENTATION_ERROR, message, strlen(message), NULL, 0);
+}
+
+static bool executeRow(const u8** const data, Buffer* buffer)
+{
+    if (call.guest->vectorized) {
+        const char* message = "Vectorized functions must be invoked through execute_columnar";
+        returnError(FUNCTION_IMPLEMENTATION_ERROR, message, strlen(message), NULL, 0);
+        return false;
+    }
+
+    // memoized functions are keyed by the bytes of the argument record
+    const u8* key = *data;
+    i32 keySize = 0;
+    u64 hash = 0;
+    if (call.guest->cache != NULL) {
+        const u8* end = key;
+        skipField(call.guest->argPlan.nodes, &end);
+        keySize = end - key;
+        hash = hashBytes(key, keySize);
+        const CacheEntry* entry = cacheLookup(call.guest->cache, hash, key, keySize);
+        if (entry != NULL) {
+            bufferAppend(buffer, entry->data + keySize, entry->resultSize);
+            *data = end;
             return true;
         }
-        case NUMBER: {
-            PyObject* string = PyObject_CallOneArg(numberToStringFunction, input);
-            if (string == NULL) {
-                resultError(input, "NUMBER");
-                return false;
-            }
-            if (!bufferAppendString(buffer, string)) {
-                Py_DECREF(string);
-                resultError(input, "NUMBER");
-                return false;
-            }
-            Py_DECREF(string);
-            return true;
+    }
+
+    PyObject* stack[STACK_ARGUMENTS];
+    const i32 argCount = call.guest->argPlan.nodes->count;
+    PyObject** args = argumentArray(stack, argCount);
+    i64 start = phaseSample(&stats.decode);
+    decodeArguments(data, args);
+    phaseSampleEnd(&stats.decode, start);
+    PyObject* value = invokeGuest(args, argCount);
+    releaseArgumentArray(args, argCount, stack);
+    if (!releaseArgumentViews() && value != NULL) {
+        Py_DECREF(value);
+        retainedViewError();
+        return false;
+    }
+    if (value == NULL) {
+        return false;
+    }
+
+    start = phaseSample(&stats.encode);
+    const i32 resultStart = buffer->used;
+    reserveResult(buffer, call.guest->returnPlan.nodes, value);
+    const bool success = encodeField(call.guest->returnPlan.nodes, value, buffer);
+    Py_DECREF(value);
+    phaseSampleEnd(&stats.encode, start);
+    if (success && call.guest->cache != NULL) {
+        cacheInsert(call.guest->cache, hash, key, keySize, buffer->data + resultStart, buffer->used - resultStart);
+    }
+    return success;
+}
+
+u8* execute(const u8* data)
+{
+    return executeFunction(registry.lastHandle, data);
+}
+
+u8* executeFunction(const i32 handle, const u8* data)
+{
+    DEBUG("executeFunction(%d)", handle);
+    selectScalar(handle);
+    Buffer buffer = newResultBuffer();
+    if (!executeRow(&data, &buffer)) {
+        free(buffer.data);
+        return NULL;
+    }
+    DEBUG("execute: completed");
+    return finishResultBuffer(&buffer);
+}
+
+u8* executeBatch(const i32 rowCount, const u8* data)
+{
+    return executeFunctionBatch(registry.lastHandle, rowCount, data);
+}
+
+// appends the batch result slot of a row, with errors written to errorBuffer
+static void executeBatchRow(const u8** const data, Buffer* buffer)
+{
+    const i32 start = buffer->used;
+    bufferAppendI8(buffer, BATCH_ROW_SUCCESS);
+    call.errorBuffer->used = 0;
+    if (!executeRow(data, buffer)) {
+        buffer->used = start;
+        bufferAppendI8(buffer, BATCH_ROW_ERROR);
+        bufferAppend(buffer, call.errorBuffer->data, call.errorBuffer->used);
+    }
+}
+
+u8* executeFunctionBatch(const i32 handle, const i32 rowCount, const u8* data)
+{
+    selectScalar(handle);
+    DEBUG("executeBatch(%d)", rowCount);
+    Buffer buffer = arenaBuffer();
+
+    call.errorBuffer = scratchBuffer(&scratch.rowError);
+    for (i32 row = 0; row < rowCount; row++) {
+        executeBatchRow(&data, &buffer);
+    }
+    call.errorBuffer = NULL;
+
+    DEBUG("executeBatch: completed");
+    return finishArenaBuffer(&buffer);
+}
+
+u8* executeFunctionDictionary(const i32 handle, const i32 entryCount, const u8* entries, const i32 rowCount, const i32* ids)
+{
+    selectScalar(handle);
+    DEBUG("executeDictionary(%d, %d)", entryCount, rowCount);
+
+    // entries that no row refers to are not evaluated, so that they cannot fail
+    Buffer* referenced = scratchBuffer(&scratch.dictionary);
+    bufferReserve(referenced, entryCount);
+    memset(referenced->data, 0, entryCount);
+    for (i32 row = 0; row < rowCount; row++) {
+        if (ids[row] < 0 || ids[row] >= entryCount) {
+            FATAL("Invalid dictionary id %d at row %d", ids[row], row);
         }
-        case VARCHAR:
-        case JSON: {
-            const char* typeName = trinoType == VARCHAR ? "VARCHAR" : "JSON";
-            if (!checkType(input, &PyUnicode_Type)) {
-                resultError(input, typeName);
-                return false;
-            }
-            if (!bufferAppendString(buffer, input)) {
-                resultError(input, typeName);
-                return false;
-            }
-            return true;
+        referenced->data[ids[row]] = true;
+    }
+
+    Buffer buffer = arenaBuffer();
+    call.errorBuffer = scratchBuffer(&scratch.rowError);
+    for (i32 entry = 0; entry < entryCount; entry++) {
+        if (referenced->data[entry]) {
+            executeBatchRow(&entries, &buffer);
         }
-        case VARBINARY: {
-            Py_buffer view;
-            if (PyObject_GetBuffer(input, &view, PyBUF_SIMPLE) == -1) {
-                resultError(input, "VARBINARY");
-                return false;
-            }
-            bufferAppendI32(buffer, view.len);
-            bufferAppend(buffer, view.buf, view.len);
-            PyBuffer_Release(&view);
-            return true;
+        else {
+            skipField(call.guest->argPlan.nodes, &entries);
+            bufferAppendI8(&buffer, BATCH_ROW_SUCCESS);
+            bufferAppendI8(&buffer, false);
         }
-        case DATE: {
-            if (!checkType(input, PyDateTimeAPI->DateType)) {
-                resultError(input, "DATE");
-                return false;
-            }
-            struct tm t = {
-                .tm_year = PyDateTime_GET_YEAR(input) - 1900,
-                .tm_mon = PyDateTime_GET_MONTH(input) - 1,
-                .tm_mday = PyDateTime_GET_DAY(input),
-            };
-            const i32 days = timegm(&t) / (24 * 60 * 60);
-            bufferAppendI32(buffer, days);
-            return true;
+    }
+    call.errorBuffer = NULL;
+
+    DEBUG("executeDictionary: completed");
+    return finishArenaBuffer(&buffer);
+}
+
+// encodes an aggregate state or output value as a result record
+static u8* encodeResult(const TypeNode* node, PyObject* value)
+{
+    const i64 start = phaseSample(&stats.encode);
+    Buffer buffer = newResultBuffer();
+    reserveResult(&buffer, node, value);
+    const bool success = encodeField(node, value, &buffer);
+    Py_DECREF(value);
+    phaseSampleEnd(&stats.encode, start);
+    if (!success) {
+        free(buffer.data);
+        return NULL;
+    }
+    return finishResultBuffer(&buffer);
+}
+
+static PyObject* decodeState(const u8* state)
+{
+    const i64 start = phaseSample(&stats.decode);
+    PyObject* value = decodeField(call.guest->statePlan.nodes, &state);
+    phaseSampleEnd(&stats.decode, start);
+    return value;
+}
+
+u8* aggregateCreate(const i32 handle)
+{
+    DEBUG("aggregateCreate(%d)", handle);
+    selectAggregate(handle);
+    PyObject* state = invokeGuestFunction(call.guest->createFunction, NULL, NULL, 0);
+    if (state == NULL) {
+        return NULL;
+    }
+    return encodeResult(call.guest->statePlan.nodes, state);
+}
+
+u8* aggregateInput(const i32 handle, const u8* state, const i32 rowCount, const u8* data)
+{
+    DEBUG("aggregateInput(%d, %d)", handle, rowCount);
+    selectAggregate(handle);
+    PyObject* value = decodeState(state);
+    PyObject* stack[STACK_ARGUMENTS];
+    const i32 argCount = call.guest->argPlan.nodes->count + 1;
+    PyObject** args = argumentArray(stack, argCount);
+    for (i32 row = 0; row < rowCount; row++) {
+        // the state is passed first, and replaced by the returned state
+        const i64 start = phaseSample(&stats.decode);
+        args[0] = value;
+        decodeArguments(&data, args + 1);
+        phaseSampleEnd(&stats.decode, start);
+
+        value = invokeGuest(args, argCount);
+        for (i32 i = 0; i < argCount; i++) {
+            Py_DECREF(args[i]);
         }
-        case TIME: {
-            if (!checkType(input, PyDateTimeAPI->TimeType)) {
-                resultError(input, "TIME");
-                return false;
-            }
-            const i64 micros =
-                PyDateTime_TIME_GET_HOUR(input) * (60 * 60 * MICROSECONDS) +
-                PyDateTime_TIME_GET_MINUTE(input) * (60 * MICROSECONDS) +
-                PyDateTime_TIME_GET_SECOND(input) * MICROSECONDS +
-                PyDateTime_TIME_GET_MICROSECOND(input);
-            bufferAppendI64(buffer, micros);
-            return true;
+        if (!releaseArgumentViews() && value != NULL) {
+            Py_CLEAR(value);
+            retainedViewError();
         }
-        case TIME_WITH_TIME_ZONE: {
-            if (!checkType(input, PyDateTimeAPI->TimeType)) {
-                resultError(input, "TIME WITH TIME ZONE");
-                return false;
-            }
-            const i64 micros =
-                PyDateTime_TIME_GET_HOUR(input) * (60 * 60 * MICROSECONDS) +
-                PyDateTime_TIME_GET_MINUTE(input) * (60 * MICROSECONDS) +
-                PyDateTime_TIME_GET_SECOND(input) * MICROSECONDS +
-                PyDateTime_TIME_GET_MICROSECOND(input);
-            bufferAppendI64(buffer, micros);
-            PyObject* delta = PyObject_CallMethod(input, "utcoffset", NULL);
-            if (delta == NULL || delta == Py_None) {
-                if (delta == Py_None) {
-                    PyErr_Format(PyExc_ValueError, "time instance does not have tzinfo");
+        if (value == NULL) {
+            break;
+        }
+    }
+    if (args != stack) {
+        free(args);
+    }
+    if (value == NULL) {
+        return NULL;
+    }
+    return encodeResult(call.guest->statePlan.nodes, value);
+}
+
+u8* aggregateCombine(const i32 handle, const u8* state, const u8* otherState)
+{
+    DEBUG("aggregateCombine(%d)", handle);
+    selectAggregate(handle);
+    PyObject* args[] = {decodeState(state), decodeState(otherState)};
+    PyObject* value = invokeGuestFunction(call.guest->combineFunction, NULL, args, 2);
+    Py_DECREF(args[0]);
+    Py_DECREF(args[1]);
+    if (value == NULL) {
+        return NULL;
+    }
+    return encodeResult(call.guest->statePlan.nodes, value);
+}
+
+u8* aggregateOutput(const i32 handle, const u8* state)
+{
+    DEBUG("aggregateOutput(%d)", handle);
+    selectAggregate(handle);
+    PyObject* arg = decodeState(state);
+    PyObject* value = invokeGuestFunction(call.guest->outputFunction, NULL, &arg, 1);
+    Py_DECREF(arg);
+    if (value == NULL) {
+        return NULL;
+    }
+    return encodeResult(call.guest->returnPlan.nodes, value);
+}
+
+// The active stream, with a copy of its argument record that views and the
+// suspended guest code may refer to. Its argument views and streams stay
+// valid while it is open, independent of the calls made in between.
+typedef struct
+{
+    PyObject* iterator;
+    i32 handle;
+    Buffer arguments;
+    Buffer row; // encoded row that did not fit in the previous chunk
+    bool rowPending;
+    PyObject* views;
+    PyObject* files;
+} StreamState;
+
+static StreamState stream = {.handle = -1};
+
+static void closeStream()
+{
+    Py_CLEAR(stream.iterator);
+    releaseArguments(stream.views, stream.files);
+    stream.handle = -1;
+    stream.rowPending = false;
+}
+
+i32 executeStream(const i32 handle, const u8* data)
+{
+    DEBUG("executeStream(%d)", handle);
+    selectScalar(handle);
+    closeStream();
+
+    const u8* end = data;
+    skipField(call.guest->argPlan.nodes, &end);
+    stream.arguments.used = 0;
+    bufferAppend(&stream.arguments, data, end - data);
+    const u8* arguments = stream.arguments.data;
+
+    PyObject* stack[STACK_ARGUMENTS];
+    const i32 argCount = call.guest->argPlan.nodes->count;
+    PyObject** args = argumentArray(stack, argCount);
+    const i64 start = phaseSample(&stats.decode);
+    decodeArguments(&arguments, args);
+    phaseSampleEnd(&stats.decode, start);
+    PyObject* value = invokeGuest(args, argCount);
+    releaseArgumentArray(args, argCount, stack);
+    retainArguments(stream.views, stream.files);
+    if (value == NULL) {
+        closeStream();
+        return 0;
+    }
+    stream.iterator = PyObject_GetIter(value);
+    Py_DECREF(value);
+    if (stream.iterator == NULL) {
+        guestError();
+        closeStream();
+        return 0;
+    }
+    stream.handle = handle;
+    return 1;
+}
+
+static void chunkCapacityError(const i32 size, const i32 capacity)
+{
+    const i32 messageSize = formatErrorMessage("Row of %d bytes exceeds the chunk capacity of %d bytes", size, capacity);
+    returnError(FUNCTION_IMPLEMENTATION_ERROR, errorMessage, messageSize, NULL, 0);
+}
+
+i32 nextChunk(u8* out, const i32 capacity)
+{
+    if (stream.iterator == NULL) {
+        return 0;
+    }
+    selectGuest(stream.handle);
+    DEBUG("nextChunk(%d)", capacity);
+
+    i32 used = sizeof(i32);
+    i32 rowCount = 0;
+    while (true) {
+        if (!stream.rowPending) {
+            i64 start = phaseSample(&stats.invoke);
+            PyObject* value = PyIter_Next(stream.iterator);
+            phaseSampleEnd(&stats.invoke, start);
+            // values the iterator decodes, such as elements of lazy arguments
+            retainArguments(stream.views, stream.files);
+            if (value == NULL) {
+                if (PyErr_Occurred()) {
+                    guestError();
+                    closeStream();
+                    return -1;
                 }
-                resultError(input, "TIME WITH TIME ZONE");
-                return false;
+                closeStream();
+                break;
             }
-            const i16 offset =
-                PyDateTime_DELTA_GET_DAYS(delta) * 24 * 60 +
-                PyDateTime_DELTA_GET_SECONDS(delta) / 60;
-            Py_DECREF(delta);
-            bufferAppendI16(buffer, offset);
-            return true;
-        }
-        case TIMESTAMP: {
-            if (!checkType(input, PyDateTimeAPI->DateTimeType)) {
-                resultError(input, "TIMESTAMP");
-                return false;
+
+            start = phaseSample(&stats.encode);
+            stream.row.used = 0;
+            reserveResult(&stream.row, call.guest->returnPlan.nodes, value);
+            const bool success = encodeField(call.guest->returnPlan.nodes, value, &stream.row);
+            Py_DECREF(value);
+            phaseSampleEnd(&stats.encode, start);
+            if (!success) {
+                closeStream();
+                return -1;
             }
-            struct tm t = {
-                .tm_year = PyDateTime_GET_YEAR(input) - 1900,
-                .tm_mon = PyDateTime_GET_MONTH(input) - 1,
-                .tm_mday = PyDateTime_GET_DAY(input),
-                .tm_hour = PyDateTime_DATE_GET_HOUR(input),
-                .tm_min = PyDateTime_DATE_GET_MINUTE(input),
-                .tm_sec = PyDateTime_DATE_GET_SECOND(input),
-            };
-            i64 micros = timegm(&t) * MICROSECONDS;
-            micros += PyDateTime_DATE_GET_MICROSECOND(input);
-            bufferAppendI64(buffer, micros);
-            return true;
+            stream.rowPending = true;
         }
-        case TIMESTAMP_WITH_TIME_ZONE: {
-            if (!checkType(input, PyDateTimeAPI->DateTimeType)) {
-                resultError(input, "TIMESTAMP WITH TIME ZONE");
-                return false;
-            }
-            struct tm t = {
-                .tm_year = PyDateTime_GET_YEAR(input) - 1900,
-                .tm_mon = PyDateTime_GET_MONTH(input) - 1,
-                .tm_mday = PyDateTime_GET_DAY(input),
-                .tm_hour = PyDateTime_DATE_GET_HOUR(input),
-                .tm_min = PyDateTime_DATE_GET_MINUTE(input),
-                .tm_sec = PyDateTime_DATE_GET_SECOND(input),
-            };
-            i64 micros = timegm(&t) * MICROSECONDS;
-            micros += PyDateTime_DATE_GET_MICROSECOND(input);
-            PyObject* delta = PyObject_CallMethod(input, "utcoffset", NULL);
-            if (delta == NULL || delta == Py_None) {
-                if (delta == Py_None) {
-                    PyErr_Format(PyExc_ValueError, "datetime instance does not have tzinfo");
-                }
-                resultError(input, "TIMESTAMP WITH TIME ZONE");
-                return false;
+
+        if (stream.row.used > capacity - used) {
+            if (rowCount == 0) {
+                chunkCapacityError(stream.row.used, capacity);
+                closeStream();
+                return -1;
             }
-            const i16 offset =
-                PyDateTime_DELTA_GET_DAYS(delta) * 24 * 60 +
-                PyDateTime_DELTA_GET_SECONDS(delta) / 60;
-            micros -= offset * 60 * MICROSECONDS;
-            bufferAppendI64(buffer, micros);
-            bufferAppendI16(buffer, offset);
-            Py_DECREF(delta);
-            return true;
+            break;
         }
-        case INTERVAL_YEAR_TO_MONTH: {
-            int overflow;
-            const i32 value = PyLong_AsLongAndOverflow(input, &overflow);
-            if (value == -1 && PyErr_Occurred()) {
-                resultError(input, "INTERVAL YEAR TO MONTH");
-                return false;
-            }
-            if (overflow) {
-                overflowError("Value out of range for INTERVAL YEAR TO MONTH");
-                return false;
-            }
-            bufferAppendI32(buffer, value);
-            return true;
+        memcpy(out + used, stream.row.data, stream.row.used);
+        used += stream.row.used;
+        rowCount++;
+        stream.rowPending = false;
+    }
+
+    if (rowCount == 0) {
+        return 0;
+    }
+    memcpy(out, &rowCount, sizeof(i32));
+    return used;
+}
+
+static i32 bitmapSize(const i32 count)
+{
+    return (count + 7) / 8;
+}
+
+static bool isNull(const u8* nulls, const i32 row)
+{
+    return nulls[row / 8] & (1 << (row % 8));
+}
+
+static i32 nullCount(const u8* nulls, const i32 rowCount)
+{
+    i32 count = 0;
+    for (i32 i = 0; i < rowCount / 8; i++) {
+        count += __builtin_popcount(nulls[i]);
+    }
+    for (i32 row = rowCount / 8 * 8; row < rowCount; row++) {
+        count += isNull(nulls, row);
+    }
+    return count;
+}
+
+#define DECODE_COLUMN(valueType, convert)                           \
+    for (i32 row = 0; row < rowCount; row++) {                      \
+        PyObject* value = Py_None;                                  \
+        if (!isNull(nulls, row)) {                                  \
+            const valueType v = ((const valueType*)values)[row];    \
+            value = checked(convert);                               \
+        }                                                           \
+        PyTuple_SET_ITEM(rows[row], column, value);                 \
+    }
+
+#define CIVIL_CHUNK_ROWS 256
+
+// converts day counts a chunk at a time so the civil arithmetic runs as a
+// batch ahead of the object construction
+static void decodeCivilColumn(
+    const TypeNode* node, const u8* nulls, const u8* values,
+    const i32 rowCount, const i32 column, PyObject** const rows)
+{
+    i32 days[CIVIL_CHUNK_ROWS];
+    CivilDate dates[CIVIL_CHUNK_ROWS];
+    for (i32 start = 0; start < rowCount; start += CIVIL_CHUNK_ROWS) {
+        const i32 count = rowCount - start < CIVIL_CHUNK_ROWS ? rowCount - start : CIVIL_CHUNK_ROWS;
+        for (i32 i = 0; i < count; i++) {
+            days[i] = node->type == DATE
+                ? ((const i32*)values)[start + i]
+                : (i32)floorDiv(((const i64*)values)[start + i], MICROSECONDS_PER_DAY);
         }
-        case INTERVAL_DAY_TO_SECOND: {
-            if (!checkType(input, PyDateTimeAPI->DeltaType)) {
-                resultError(input, "INTERVAL DAY TO SECOND");
-                return false;
+        civilFromDaysBatch(days, count, dates);
+
+        for (i32 i = 0; i < count; i++) {
+            const i32 row = start + i;
+            PyObject* value = Py_None;
+            if (!isNull(nulls, row)) {
+                if (node->type == DATE) {
+                    value = newDate(days[i], dates[i]);
+                }
+                else {
+                    const i64 time = ((const i64*)values)[row] - days[i] * MICROSECONDS_PER_DAY;
+                    value = newDateTime(dates[i], time, Py_None);
+                }
             }
-            const i64 value =
-                PyDateTime_DELTA_GET_DAYS(input) * (24 * 60 * 60 * 1000) +
-                PyDateTime_DELTA_GET_SECONDS(input) * 1000 +
-                (PyDateTime_DELTA_GET_MICROSECONDS(input) + 500) / 1000;
-            bufferAppendI64(buffer, value);
-            return true;
+            PyTuple_SET_ITEM(rows[row], column, value);
         }
-        case UUID: {
-            if (!checkType(input, _PyType_CAST(uuidClass))) {
-                resultError(input, "UUID");
-                return false;
-            }
-            return appendBytesAttr(input, buffer, "bytes", "UUID");
-        }
-        case IPADDRESS: {
-            if (PyObject_IsInstance(input, ipaddressV4Class) == 1) {
-                input = PyObject_GetAttrString(input, "ipv6_mapped");
-                if (input == NULL) {
-                    resultError(input, "IPADDRESS");
-                    return false;
+    }
+}
+
+static void decodeFixedWidthColumn(
+    const TypeNode* node, const u8* nulls, const u8* values,
+    const i32 rowCount, const i32 column, PyObject** const rows)
+{
+    switch (node->type) {
+        case BOOLEAN:
+            DECODE_COLUMN(i8, v ? Py_True : Py_False);
+            return;
+        case BIGINT:
+            DECODE_COLUMN(i64, PyLong_FromLongLong(v));
+            return;
+        case INTEGER:
+            DECODE_COLUMN(i32, PyLong_FromLong(v));
+            return;
+        case SMALLINT:
+            DECODE_COLUMN(i16, PyLong_FromLong(v));
+            return;
+        case TINYINT:
+            DECODE_COLUMN(i8, PyLong_FromLong(v));
+            return;
+        case DOUBLE:
+            DECODE_COLUMN(f64, PyFloat_FromDouble(v));
+            return;
+        case REAL:
+            DECODE_COLUMN(f32, PyFloat_FromDouble(v));
+            return;
+        case DATE:
+        case TIMESTAMP:
+            decodeCivilColumn(node, nulls, values, rowCount, column, rows);
+            return;
+        default:
+            for (i32 row = 0; row < rowCount; row++) {
+                PyObject* value = Py_None;
+                if (!isNull(nulls, row)) {
+                    const u8* valueData = values + (size_t)row * node->width;
+                    value = node->decode(node, &valueData);
                 }
+                PyTuple_SET_ITEM(rows[row], column, value);
             }
-            if (PyObject_IsInstance(input, ipaddressV6Class) != 1) {
-                PyErr_Format(PyExc_TypeError, "expected an instance of type '%N' or '%N'",
-                             ipaddressV4Class, ipaddressV6Class);
-                resultError(input, "IPADDRESS");
-                return false;
+    }
+}
+
+static void decodeVariableWidthColumn(
+    const TypeNode* node, const u8* nulls, const i32* offsets, const u8* slab,
+    const i32 rowCount, const i32 column, PyObject** const rows)
+{
+    for (i32 row = 0; row < rowCount; row++) {
+        PyObject* value = Py_None;
+        if (!isNull(nulls, row)) {
+            const char* start = (const char*)slab + offsets[row];
+            const i32 size = offsets[row + 1] - offsets[row];
+            switch (node->type) {
+                case VARCHAR:
+                case JSON:
+                    value = node->decode == decodeArgumentView
+                                ? newArgumentView(start, size)
+                                : checked(PyUnicode_FromStringAndSize(start, size));
+                    break;
+                case VARBINARY:
+                    value = node->decode == decodeArgumentView
+                                ? newArgumentView(start, size)
+                                : checked(PyBytes_FromStringAndSize(start, size));
+                    break;
+                case DECIMAL:
+                case NUMBER: {
+                    PyObject* number = checked(PyUnicode_FromStringAndSize(start, size));
+                    value = checked(PyObject_CallOneArg(host.decimalClass, number));
+                    Py_DECREF(number);
+                    break;
+                }
+                default: {
+                    const u8* valueData = (const u8*)start;
+                    value = node->decode(node, &valueData);
+                }
             }
-            return appendBytesAttr(input, buffer, "packed", "IPADDRESS");
         }
+        PyTuple_SET_ITEM(rows[row], column, value);
     }
-    FATAL("Unsupported Trino type %d", trinoType);
 }
 
-static void handleTrinoError(PyObject* exception)
+static void decodeColumn(
+    const TypeNode* node, const u8** const data, const i32 rowCount, const i32 column, PyObject** const rows)
 {
-    if (exception == NULL) {
-        FATAL("Python exception not raised for function failure");
+    const i64 start = clockNanos();
+    const u8* nulls = *data;
+    *data += bitmapSize(rowCount);
+    stats.decodedValues[node->type] += rowCount - nullCount(nulls, rowCount);
+
+    if (node->width > 0) {
+        decodeFixedWidthColumn(node, nulls, *data, rowCount, column, rows);
+        *data += (size_t)rowCount * node->width;
+    }
+    else {
+        const i32* offsets = (const i32*)*data;
+        const u8* slab = *data + (rowCount + 1) * sizeof(i32);
+        decodeVariableWidthColumn(node, nulls, offsets, slab, rowCount, column, rows);
+        *data = slab + offsets[rowCount];
     }
+    stats.decodeNanos[node->type] += clockNanos() - start;
+    phaseEnd(&stats.decode, start);
+}
 
-    PyObject* error = PyObject_CallOneArg(trinoErrorResultFunction, exception);
-    if (error == NULL) {
-        if (PyErr_ExceptionMatches(PyExc_MemoryError)) {
-            memoryError();
-            return;
+typedef struct
+{
+    Buffer* buffer;
+    const TypeNode* node;
+    i32 rowCount;
+    i32 row;
+    i32 nulls;
+    i32 values;
+    Buffer* rowError;
+    Buffer* errors;
+    i32 errorCount;
+} ColumnWriter;
+
+static void columnWriterInit(ColumnWriter* writer, Buffer* buffer, const TypeNode* node, const i32 rowCount)
+{
+    const i32 width = node->width;
+    *writer = (ColumnWriter){
+        .buffer = buffer,
+        .node = node,
+        .rowCount = rowCount,
+        .nulls = buffer->used,
+        .values = buffer->used + bitmapSize(rowCount),
+        .rowError = scratchBuffer(&scratch.rowError),
+        .errors = scratchBuffer(&scratch.errors),
+    };
+
+    // fixed width values are written in place, variable width values get
+    // offsets followed by the slab
+    const i32 reserved = bitmapSize(rowCount) + (width > 0 ? rowCount * width : (rowCount + 1) * (i32)sizeof(i32));
+    bufferReserve(buffer, buffer->used + reserved);
+    memset(buffer->data + buffer->used, 0, reserved);
+    buffer->used += reserved;
+}
+
+static void columnWriterSetNull(ColumnWriter* writer)
+{
+    writer->buffer->data[writer->nulls + writer->row / 8] |= 1 << (writer->row % 8);
+}
+
+static void columnWriterError(ColumnWriter* writer)
+{
+    bufferAppendI32(writer->errors, writer->row);
+    bufferAppend(writer->errors, writer->rowError->data, writer->rowError->used);
+    writer->errorCount++;
+    columnWriterSetNull(writer);
+}
+
+static bool columnWriterEncode(ColumnWriter* writer, PyObject* value)
+{
+    Buffer* buffer = writer->buffer;
+    const TypeNode* node = writer->node;
+    stats.encodedValues[node->type]++;
+
+    if (node->width > 0) {
+        const i32 end = buffer->used;
+        const i32 start = writer->values + writer->row * node->width;
+        buffer->used = start;
+        const bool success = node->encode(node, value, buffer);
+        if (!success) {
+            memset(buffer->data + start, 0, node->width);
         }
-        PyErr_Print();
-        FATAL("Failed to convert Python exception to Trino error");
+        buffer->used = end;
+        return success;
     }
 
-    PyObject* errorCodeObject = PyTuple_GetItem(error, 0);
-    if (errorCodeObject == NULL) {
-        PyErr_Print();
-        FATAL("Failed to get error code from Trino error");
+    const i32 start = buffer->used;
+    reserveResult(buffer, node, value);
+    if (!node->encode(node, value, buffer)) {
+        buffer->used = start;
+        return false;
     }
-    const i32 errorCode = PyLong_AsLong(errorCodeObject);
-    if (errorCode == -1 && PyErr_Occurred()) {
-        PyErr_Print();
-        FATAL("Failed to convert error code to integer");
+    if (isRawBytes(node->type)) {
+        memmove(buffer->data + start, buffer->data + start + sizeof(i32), buffer->used - start - sizeof(i32));
+        buffer->used -= sizeof(i32);
     }
+    return true;
+}
 
-    PyObject* messageObject = PyTuple_GetItem(error, 1);
-    if (messageObject == NULL) {
-        PyErr_Print();
-        FATAL("Failed to get error message from Trino error");
-    }
-    Py_ssize_t messageSize;
-    const char* message = PyUnicode_AsUTF8AndSize(messageObject, &messageSize);
-    if (message == NULL) {
-        PyErr_Print();
-        FATAL("Failed to get error message string");
+// append the result for the next row, where NULL means the row failed
+// and its error was recorded in rowError
+static void columnWriterAppend(ColumnWriter* writer, PyObject* value)
+{
+    i32* offsets = (i32*)(writer->buffer->data + writer->values);
+    const i32 slab = writer->values + (writer->rowCount + 1) * sizeof(i32);
+    if (writer->node->width == 0) {
+        offsets[writer->row] = writer->buffer->used - slab;
     }
 
-    PyObject* tracebackObject = PyTuple_GetItem(error, 2);
-    if (tracebackObject == NULL) {
-        PyErr_Print();
-        FATAL("Failed to get error traceback from Trino error");
+    if (value == NULL || (value != Py_None && !columnWriterEncode(writer, value))) {
+        columnWriterError(writer);
     }
-    Py_ssize_t tracebackSize;
-    const char* traceback = PyUnicode_AsUTF8AndSize(tracebackObject, &tracebackSize);
-    if (traceback == NULL) {
-        PyErr_Print();
-        FATAL("Failed to get error traceback string");
+    else if (value == Py_None) {
+        columnWriterSetNull(writer);
     }
 
-    trinoReturnError(errorCode, (u8*)message, messageSize, (u8*)traceback, tracebackSize);
-    Py_DECREF(error);
+    writer->rowError->used = 0;
+    writer->row++;
+    if (writer->node->width == 0 && writer->row == writer->rowCount) {
+        offsets = (i32*)(writer->buffer->data + writer->values);
+        offsets[writer->rowCount] = writer->buffer->used - slab;
+    }
 }
 
-u8* allocate(const i32 size)
+static void columnWriterFinish(ColumnWriter* writer)
 {
-    return xrealloc(NULL, size);
+    bufferAppendI32(writer->buffer, writer->errorCount);
+    bufferAppend(writer->buffer, writer->errors->data, writer->errors->used);
 }
 
-void deallocate(u8* pointer)
+static bool copyVectorResult(PyObject* result, const TypeNode* node, const i32 rowCount, u8* values)
 {
-    return free(pointer);
+    const char* typeName = vectorTypes[node->type].name;
+    Py_buffer view;
+    if (PyObject_GetBuffer(result, &view, PyBUF_CONTIG_RO | PyBUF_FORMAT) == -1) {
+        resultError(result, typeName);
+        return false;
+    }
+    if (!formatMatches(node, &view)) {
+        PyErr_Format(PyExc_TypeError, "buffer format '%s' with item size %zd does not match '%s'",
+                     view.format == NULL ? "B" : view.format, view.itemsize, vectorTypes[node->type].format);
+        PyBuffer_Release(&view);
+        resultError(result, typeName);
+        return false;
+    }
+    if (view.len != (Py_ssize_t)rowCount * node->width) {
+        PyErr_Format(PyExc_ValueError, "buffer has %zd items, expected %d items",
+                     view.len / view.itemsize, rowCount);
+        PyBuffer_Release(&view);
+        resultError(result, typeName);
+        return false;
+    }
+    if (view.buf != values) {
+        memcpy(values, view.buf, view.len);
+    }
+    PyBuffer_Release(&view);
+    return true;
 }
 
-void setup(const u8* functionName, const u8* argType, const u8* returnType)
+// invoke the guest once with each argument column as a memoryview
+static u8* executeVectorized(const i32 rowCount, const u8* data)
 {
-    const char* name = (const char*)functionName;
-    DEBUG("setup('%s')", name);
+    const TypeNode* node = call.guest->argPlan.nodes;
+    const TypeNode* returnNode = call.guest->returnPlan.nodes;
+    const i32 nullsSize = bitmapSize(rowCount);
+
+    Buffer buffer = arenaBuffer();
+    const i32 reserved = nullsSize + rowCount * returnNode->width;
+    bufferReserve(&buffer, buffer.used + reserved + (i32)sizeof(i32));
+    u8* nulls = buffer.data + buffer.used;
+    u8* values = nulls + nullsSize;
+    memset(nulls, 0, reserved);
+    buffer.used += reserved;
+
+    i64 start = clockNanos();
+    PyObject* views = checked(PyTuple_New(node->count));
+    const TypeNode* field = node + 1;
+    for (i32 column = 0; column < node->count; column++) {
+        stats.decodedValues[field->type] += rowCount - nullCount(data, rowCount);
+        for (i32 i = 0; i < nullsSize; i++) {
+            nulls[i] |= data[i];
+        }
+        data += nullsSize;
 
-    PyObject* path = PySys_GetObject("path");
-    PyObject* entry = PyUnicode_FromString("/guest");
-    PyList_Append(path, entry);
-    Py_DECREF(entry);
+        Py_ssize_t shape = rowCount;
+        Py_ssize_t stride = field->width;
+        Py_buffer view = {
+            .buf = (void*)data,
+            .len = (Py_ssize_t)rowCount * field->width,
+            .itemsize = field->width,
+            .readonly = 1,
+            .ndim = 1,
+            .format = (char*)vectorTypes[field->type].format,
+            .shape = &shape,
+            .strides = &stride,
+        };
+        PyTuple_SET_ITEM(views, column, checked(PyMemoryView_FromBuffer(&view)));
+        data += (size_t)rowCount * field->width;
+        field = nextSibling(field);
+    }
+    phaseEnd(&stats.decode, start);
 
-    guestFunction = findFunction(loadModule("guest"), name);
+    PyObject* result = invokeGuest(PySequence_Fast_ITEMS(views), PyTuple_GET_SIZE(views));
 
-    trinoArgType = argType;
-    trinoReturnType = returnType;
+    // the result is copied while the argument columns are still valid, so it
+    // may be one of them or a view over one, as identity kernels return
+    start = clockNanos();
+    bool success = result != NULL && copyVectorResult(result, returnNode, rowCount, values);
+    Py_XDECREF(result);
+    phaseEnd(&stats.encode, start);
+    if (!releaseViews(views)) {
+        PyErr_Clear();
+        if (success) {
+            const char* message = "Vectorized function retained a reference to an argument column";
+            returnError(FUNCTION_IMPLEMENTATION_ERROR, message, strlen(message), NULL, 0);
+            success = false;
+        }
+    }
+    Py_DECREF(views);
+    if (!success) {
+        arenaRelease(&buffer);
+        return NULL;
+    }
+    stats.encodedValues[returnNode->type] += rowCount - nullCount(nulls, rowCount);
 
-    DEBUG("Setup complete");
+    bufferAppendI32(&buffer, 0);
+    return finishArenaBuffer(&buffer);
 }
 
-u8* execute(const u8* data)
+u8* executeColumnar(const i32 rowCount, const u8* data)
 {
-    DEBUG("execute()");
-    PyObject* args = buildArgs(data);
+    return executeFunctionColumnar(registry.lastHandle, rowCount, data);
+}
 
-#ifndef NDEBUG
-    PyObject* str = PyObject_Str(args);
-    DEBUG("invoke(%s)", PyUnicode_AsUTF8(str));
-    Py_DECREF(str);
-#endif
+u8* executeFunctionColumnar(const i32 handle, const i32 rowCount, const u8* data)
+{
+    selectScalar(handle);
+    DEBUG("executeColumnar(%d)", rowCount);
+    if (call.guest->vectorized) {
+        return executeVectorized(rowCount, data);
+    }
 
-    PyObject* value = PyObject_CallObject(guestFunction, args);
-    if (value == NULL) {
-        PyObject* exception = PyErr_GetRaisedException();
-        handleTrinoError(exception);
-        Py_DECREF(exception);
-        Py_DECREF(args);
+    const TypeNode* node = call.guest->argPlan.nodes;
+    if (node->type != ROW) {
+        FATAL("Columnar execution requires a ROW argument type");
+    }
+    const i32 columnCount = node->count;
+
+    PyObject** rows = scratchRows(rowCount);
+    for (i32 row = 0; row < rowCount; row++) {
+        rows[row] = checked(PyTuple_New(columnCount));
+    }
+    const TypeNode* field = node + 1;
+    for (i32 column = 0; column < columnCount; column++) {
+        decodeColumn(field, &data, rowCount, column, rows);
+        field = nextSibling(field);
+    }
+
+    Buffer buffer = arenaBuffer();
+    ColumnWriter writer;
+    columnWriterInit(&writer, &buffer, call.guest->returnPlan.nodes, rowCount);
+
+    call.errorBuffer = writer.rowError;
+    for (i32 row = 0; row < rowCount; row++) {
+        PyObject* value = invokeGuest(PySequence_Fast_ITEMS(rows[row]), PyTuple_GET_SIZE(rows[row]));
+        Py_DECREF(rows[row]);
+        const i64 start = phaseSample(&stats.encode);
+        columnWriterAppend(&writer, value);
+        Py_XDECREF(value);
+        stats.encodeNanos[writer.node->type] += phaseSampleEnd(&stats.encode, start);
+    }
+    call.errorBuffer = NULL;
+
+    // views of every row stay valid until the whole batch has been invoked
+    if (!releaseArgumentViews()) {
+        arenaRelease(&buffer);
+        retainedViewError();
         return NULL;
     }
-    Py_DECREF(args);
 
-    u8* result = NULL;
-    const u8* type = trinoReturnType;
-    Buffer buffer = {
-        .data = xrealloc(NULL, 1024),
-        .size = 1024,
-        .used = 4,
+    columnWriterFinish(&writer);
+
+    DEBUG("executeColumnar: completed");
+    return finishArenaBuffer(&buffer);
+}
+
+#define WASM_PAGE_SIZE (64 * 1024)
+
+// transient buffers are freed rather than recorded in the checkpoint image
+static void freeScratch()
+{
+    free(arena.data);
+    arena = (ResultArena){0};
+    arenaLastUsed = 0;
+    arenaPeak = 0;
+    arenaCalls = 0;
+    free(scratch.rowError.data);
+    scratch.rowError = (Buffer){0};
+    free(scratch.errors.data);
+    scratch.errors = (Buffer){0};
+    free(scratch.dictionary.data);
+    scratch.dictionary = (Buffer){0};
+    free(scratch.rows);
+    scratch.rows = NULL;
+    scratch.rowsCapacity = 0;
+    closeStream();
+    free(stream.arguments.data);
+    stream.arguments = (Buffer){0};
+    free(stream.row.data);
+    stream.row = (Buffer){0};
+}
+
+// settings of the caller that reset restores to their state at the checkpoint
+typedef struct
+{
+    i32 tracebackLimit;
+    bool profiling;
+} CheckpointSettings;
+
+static CheckpointSettings checkpointSettings;
+
+static i64 memorySize()
+{
+#ifdef __wasm__
+    return (i64)__builtin_wasm_memory_size(0) * WASM_PAGE_SIZE;
+#else
+    return 0;
+#endif
+}
+
+i64 checkpoint()
+{
+    DEBUG("checkpoint()");
+    freeScratch();
+    freezeHeap();
+    registry.checkpointCount = registry.count;
+    registry.checkpointLastHandle = registry.lastHandle;
+    checkpointSettings = (CheckpointSettings){
+        .tracebackLimit = tracebacks.limit,
+        .profiling = profiler.active,
     };
-    if (buildResult(&type, value, &buffer)) {
-        result = buffer.data;
-        *(i32*)result = buffer.used - 4;
+    return memorySize();
+}
+
+i64 trim()
+{
+    DEBUG("trim()");
+    freeScratch();
+    PyGC_Collect();
+    return memorySize();
+}
+
+void reset()
+{
+    DEBUG("reset()");
+    if (registry.checkpointCount < 0) {
+        FATAL("reset() called without a checkpoint");
     }
-    else {
-        free(buffer.data);
+    for (i32 i = registry.checkpointCount; i < registry.count; i++) {
+        GuestFunction* function = &registry.functions[i];
+        Py_DECREF(function->callable);
+        Py_XDECREF(function->createFunction);
+        Py_XDECREF(function->combineFunction);
+        Py_XDECREF(function->outputFunction);
+        free(function->argPlan.nodes);
+        free(function->returnPlan.nodes);
+        free(function->statePlan.nodes);
+        freeResultCache(function->cache);
     }
-    Py_DECREF(value);
+    registry.count = registry.checkpointCount;
+    registry.lastHandle = registry.checkpointLastHandle;
+    call.guest = NULL;
 
-    DEBUG("execute: completed");
-    return result;
+    call.errorBuffer = NULL;
+    releaseArgumentViews();
+    PyErr_Clear();
+    Py_CLEAR(tracebacks.lastException);
+    freeScratch();
+
+    setTracebackLimit(checkpointSettings.tracebackLimit);
+    // the profile of the previous caller is dropped either way
+    if (checkpointSettings.profiling) {
+        profileStart();
+    }
+    else {
+        profileStop();
+        if (profiler.nodes != NULL) {
+            profileClear();
+        }
+    }
+    DEBUG("reset: functions=%d", registry.count);
 }
 
 static PyObject* loadModule(const char* name)
@@ -1011,24 +4582,52 @@ int main(const int argc, char* argv[])
     (void)argv;
     DEBUG("Initializing Python host");
 
+#ifdef PYHOST_FROZEN_MODULES
+    PyImport_FrozenModules = pyhostFrozenModules;
+#endif
+
+    PyImport_AppendInittab("_pyhost", initPyhostModule);
     Py_Initialize();
     DEBUG("Python initialized");
 
     PyDateTime_IMPORT;
 
-    emptyTuple = PyTuple_New(0);
+    host.emptyTuple = PyTuple_New(0);
+    call.argumentViews = checked(PyList_New(0));
+    call.argumentStreams = checked(PyList_New(0));
+    stream.views = checked(PyList_New(0));
+    stream.files = checked(PyList_New(0));
 
-    decimalClass = findFunction(loadModule("decimal"), "Decimal");
-    uuidClass = findFunction(loadModule("uuid"), "UUID");
+    PyObject* decimalModule = loadModule("decimal");
+    host.decimalClass = findFunction(decimalModule, "Decimal");
+    PyObject* contextArgs = checked(Py_BuildValue("{s:i,s:N}",
+        "prec", MAX_DECIMAL_PRECISION, "rounding", checked(PyObject_GetAttrString(decimalModule, "ROUND_HALF_UP"))));
+    host.decimalContext = checked(PyObject_Call(findFunction(decimalModule, "Context"), host.emptyTuple, contextArgs));
+    Py_DECREF(contextArgs);
+    PyObject* uuidModule = loadModule("uuid");
+    host.uuidClass = findFunction(uuidModule, "UUID");
+    host.uuidIntOffset = slotOffset(host.uuidClass, "int");
+    host.uuidIsSafeOffset = slotOffset(host.uuidClass, "is_safe");
+    host.uuidSafeUnknown = checked(PyObject_GetAttrString(findFunction(uuidModule, "SafeUUID"), "unknown"));
 
     PyObject* ipaddressModule = loadModule("ipaddress");
-    ipaddressV4Class = findFunction(ipaddressModule, "IPv4Address");
-    ipaddressV6Class = findFunction(ipaddressModule, "IPv6Address");
+    host.ipaddressV4Class = findFunction(ipaddressModule, "IPv4Address");
+    host.ipaddressV6Class = findFunction(ipaddressModule, "IPv6Address");
+    host.ipv4IpOffset = slotOffset(host.ipaddressV4Class, "_ip");
+    host.ipv6IpOffset = slotOffset(host.ipaddressV6Class, "_ip");
+    host.ipv6ScopeIdOffset = slotOffset(host.ipaddressV6Class, "_scope_id");
 
     PyObject* trinoModule = loadModule("trino");
-    trinoErrorResultFunction = findFunction(trinoModule, "_trino_error_result");
-    decimalToStringFunction = findFunction(trinoModule, "_decimal_to_string");
-    numberToStringFunction = findFunction(trinoModule, "_number_to_string");
+    host.trinoErrorClass = findFunction(trinoModule, "TrinoError");
+    host.formatTracebackFunction = findFunction(trinoModule, "_trino_format_traceback");
+    host.decimalToStringFunction = findFunction(trinoModule, "_decimal_to_string");
+    host.numberToStringFunction = findFunction(trinoModule, "_number_to_string");
+    host.openChunkedFunction = findFunction(trinoModule, "_open_chunked");
+    host.lazyMapClass = (PyTypeObject*)findFunction(trinoModule, "LazyMap");
+    host.lazyArrayClass = (PyTypeObject*)findFunction(trinoModule, "LazyArray");
+    host.lazyRowClass = (PyTypeObject*)findFunction(trinoModule, "LazyRow");
+
+    freezeHeap();
 
     DEBUG("Python host initialized");
     return 0;
@@ -3,10 +3,15 @@
 #include <stdint.h>
 
 // Trino types
+static const int DIVISION_BY_ZERO = 8;
 static const int NUMERIC_VALUE_OUT_OF_RANGE = 19;
 static const int EXCEEDED_FUNCTION_MEMORY_LIMIT = 37;
 static const int FUNCTION_IMPLEMENTATION_ERROR = 65549;
 
+// Batch result row status
+static const int BATCH_ROW_SUCCESS = 0;
+static const int BATCH_ROW_ERROR = 1;
+
 typedef enum
 {
     ROW = 0, // field count, field types
@@ -33,8 +38,11 @@ typedef enum
     UUID = 21,
     IPADDRESS = 22,
     NUMBER = 23,
+    UNSCALED_DECIMAL = 24, // precision, scale
 } TrinoType;
 
+#define TRINO_TYPE_COUNT 25
+
 // WebAssembly types
 typedef uint8_t u8;
 typedef uint16_t u16;
@@ -49,14 +57,189 @@ typedef int64_t i64;
 typedef float f32;
 typedef double f64;
 
+typedef struct
+{
+    u8* data;
+    i32 capacity;
+} ResultArena;
+
+#define HOST_STATS_VERSION 1
+
+typedef struct
+{
+    i64 count;
+    i64 nanos;
+} PhaseStats;
+
+// Cumulative host statistics. Time spent handling errors is also included in
+// the phase the error occurred in. Per-row phases take the clock for one in 64
+// occurrences and add the sample scaled by 64, so their times are estimates,
+// while whole columns and errors are always timed. Values are counted by type
+// at every nesting level, and the per-type times cover the columns of
+// execute_columnar, with the encoding of scalar results sampled per row.
+typedef struct
+{
+    i32 version;
+    i32 typeCount;
+    PhaseStats decode;
+    PhaseStats invoke;
+    PhaseStats encode;
+    PhaseStats error;
+    i64 decodedValues[TRINO_TYPE_COUNT];
+    i64 encodedValues[TRINO_TYPE_COUNT];
+    i64 decodeNanos[TRINO_TYPE_COUNT];
+    i64 encodeNanos[TRINO_TYPE_COUNT];
+} HostStats;
+
+// Result cache counters of a function declared with trino.memoize.
+typedef struct
+{
+    i64 hits;
+    i64 misses;
+    i64 evictions;
+    i64 entries;
+    i64 bytes;
+} CacheStats;
+
 // WebAssembly functions
 __attribute__((export_name("allocate"))) u8* allocate(i32 size);
 __attribute__((export_name("deallocate"))) void deallocate(u8* pointer);
 
-__attribute__((export_name("setup"))) void setup(
+// Imports the guest module and resolves the comma separated function names in
+// the TRINO_GUEST_FUNCTIONS environment variable. This is the init function of
+// the per-package Wizer snapshot, so that setup finds the module already loaded.
+// Like main, it ends by freezing the heap: the snapshot objects move to the
+// permanent GC generation, so collections in instances skip them.
+__attribute__((export_name("initialize_guest"))) void initializeGuest();
+
+// setup may be called once per guest function and returns the handle used
+// by the execute_function entry points. The entry points without a handle
+// invoke the function of the most recent setup call.
+__attribute__((export_name("setup"))) i32 setup(
     const u8* functionName, const u8* argType, const u8* returnType);
 
+// Streamed arguments. chunked_arguments returns the bit set of the top level
+// VARCHAR and VARBINARY arguments, by position, that the function declared
+// with trino.chunked. In argument records, such a value is encoded as an i32
+// stream id chosen by the caller instead of its length and bytes. The guest
+// pulls the value through read_chunk, which writes up to capacity bytes of the
+// stream to buffer and returns the number written, zero at the end of the
+// value, or -1 if the stream cannot be read. Streams are read in order and
+// only while the call that received them is running, which for execute_stream
+// lasts until the stream ends.
+__attribute__((export_name("chunked_arguments"))) i32 chunkedArguments(i32 handle);
+
 __attribute__((export_name("execute"))) u8* execute(const u8* data);
+__attribute__((export_name("execute_function"))) u8* executeFunction(i32 handle, const u8* data);
+
+// Streaming of functions that return an iterator, such as generators, with
+// one result record of the return type per row. execute_stream invokes the
+// function and returns zero if it failed. Each next_chunk call resumes the
+// iterator and writes the row count followed by as many records as fit in
+// capacity bytes to out, returning the bytes written, zero once the stream is
+// exhausted, or -1 if the guest failed. Starting a stream ends the previous one.
+// Argument views and streams of the stream stay valid until it ends, across
+// calls to other entry points in between.
+__attribute__((export_name("execute_stream"))) i32 executeStream(i32 handle, const u8* data);
+__attribute__((export_name("next_chunk"))) i32 nextChunk(u8* out, i32 capacity);
+
+// Aggregate functions. The guest object, usually a class of static methods,
+// provides create() returning an initial state, input(state, *args) and
+// combine(state, other) returning the updated state, and output(state)
+// returning the result. States are returned as result records of stateType
+// and passed back without the length prefix, so that Trino can save, combine
+// and spill partial aggregations. aggregate_input takes rowCount argument
+// records back to back. Results are released with deallocate, and are NULL
+// if the guest failed.
+__attribute__((export_name("setup_aggregate"))) i32 setupAggregate(
+    const u8* aggregateName, const u8* argType, const u8* stateType, const u8* returnType);
+__attribute__((export_name("aggregate_create"))) u8* aggregateCreate(i32 handle);
+__attribute__((export_name("aggregate_input"))) u8* aggregateInput(
+    i32 handle, const u8* state, i32 rowCount, const u8* data);
+__attribute__((export_name("aggregate_combine"))) u8* aggregateCombine(
+    i32 handle, const u8* state, const u8* otherState);
+__attribute__((export_name("aggregate_output"))) u8* aggregateOutput(i32 handle, const u8* state);
+
+// Results of the batch entry points are written to a host-owned arena that
+// is reused by the next call and must not be deallocated.
+__attribute__((export_name("result_arena"))) const ResultArena* resultArena();
+
+// data is rowCount argument records back to back. The result holds one slot
+// per row: BATCH_ROW_SUCCESS followed by the result record, or BATCH_ROW_ERROR
+// followed by the error code, message and traceback (each length-prefixed).
+__attribute__((export_name("execute_batch"))) u8* executeBatch(i32 rowCount, const u8* data);
+__attribute__((export_name("execute_function_batch"))) u8* executeFunctionBatch(
+    i32 handle, i32 rowCount, const u8* data);
+
+// Dictionary encoded input: entries is entryCount distinct argument records
+// back to back, and ids is the entry of each of the rowCount rows. The function
+// is invoked once per entry that a row refers to, and the result holds one
+// batch result slot per entry, with a null result for entries that no row
+// refers to. The result is the dictionary of a result with the same ids.
+__attribute__((export_name("execute_function_dictionary"))) u8* executeFunctionDictionary(
+    i32 handle, i32 entryCount, const u8* entries, i32 rowCount, const i32* ids);
+
+// Columnar encoding, with one column per argument. Each column starts with
+// a null bitmap (bit set when the row is null), followed by the row values
+// for fixed width types, or by rowCount + 1 offsets into a byte slab for
+// variable width types. The slab holds the raw bytes for string types and
+// the record encoding (without the presence flag) for ROW, ARRAY and MAP.
+// The result is the return column in the same shape, followed by the error
+// count and for each failed row its index, error code, message and traceback.
+// Functions declared with trino.vectorized are invoked once for the whole
+// batch and return NULL if they fail.
+__attribute__((export_name("execute_columnar"))) u8* executeColumnar(i32 rowCount, const u8* data);
+__attribute__((export_name("execute_function_columnar"))) u8* executeFunctionColumnar(
+    i32 handle, i32 rowCount, const u8* data);
+
+// Instance pooling. checkpoint marks the current state, normally right after
+// setup, as the one to return to: it frees transient buffers, collects
+// garbage and freezes the remaining objects, and returns the linear memory
+// size in bytes that the host should save. To recycle an instance, the host
+// restores the saved image into a memory of that size and calls reset, which
+// also works on its own as a soft reset: it unregisters functions set up after
+// the checkpoint, drops per-call state, and restores the traceback limit and
+// profiling to their state at the checkpoint, but cannot undo guest module
+// state. Stats keep accumulating across resets, but restoring the image rewinds
+// them with the rest of memory, so the host reads them before recycling.
+// Memory sizes are i64, as a wasm32 memory can reach 4 GiB.
+__attribute__((export_name("checkpoint"))) i64 checkpoint();
+__attribute__((export_name("reset"))) void reset();
+
+// Frees transient buffers and collects garbage between calls, ending any
+// active stream, and returns the linear memory size in bytes. Linear memory
+// cannot shrink, so a pool recycles an instance from its checkpoint image
+// when the size has grown far beyond the checkpoint after a spike.
+__attribute__((export_name("trim"))) i64 trim();
+
+// Formats tracebacks only for the next limit errors, or for all errors when
+// negative, which is the default. last_traceback formats the traceback of the
+// most recent error on demand, as a length-prefixed buffer to be released with
+// deallocate, or returns NULL if there was no error.
+__attribute__((export_name("set_traceback_limit"))) void setTracebackLimit(i32 limit);
+__attribute__((export_name("last_traceback"))) u8* lastTraceback();
+
+// Copies the HostStats struct to out and returns the number of bytes written.
+__attribute__((export_name("get_stats"))) i32 getStats(u8* out);
+__attribute__((export_name("reset_stats"))) void resetStats();
+
+// Copies the CacheStats struct of the function to out and returns the number
+// of bytes written, or zero if the function is not memoized.
+__attribute__((export_name("get_cache_stats"))) i32 getCacheStats(i32 handle, u8* out);
+
+// Profiling of guest Python code, with no cost while stopped. The profile is
+// a call tree of Python and built-in functions, bounded to a fixed number of
+// distinct call paths. profile_dump returns it in the collapsed stack format
+// used by flame graph tools, weighted by self time in microseconds or by call
+// count, as a length-prefixed buffer to be released with deallocate.
+static const int PROFILE_SELF_TIME = 0;
+static const int PROFILE_CALLS = 1;
+
+__attribute__((export_name("profile_start"))) void profileStart();
+__attribute__((export_name("profile_stop"))) void profileStop();
+__attribute__((export_name("profile_dump"))) u8* profileDump(i32 metric);
 
 __attribute__((import_module("trino"), import_name("return_error"))) void trinoReturnError(
     i32 errorCode, const u8* message, i32 messageSize, const u8* traceback, i32 tracebackSize);
+__attribute__((import_module("trino"), import_name("read_chunk"))) i32 trinoReadChunk(
+    i32 stream, u8* buffer, i32 capacity);
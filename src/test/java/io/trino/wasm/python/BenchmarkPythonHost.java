@@ -0,0 +1,359 @@
+/*
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+package io.trino.wasm.python;
+
+import org.openjdk.jmh.annotations.Benchmark;
+import org.openjdk.jmh.annotations.BenchmarkMode;
+import org.openjdk.jmh.annotations.Fork;
+import org.openjdk.jmh.annotations.Measurement;
+import org.openjdk.jmh.annotations.Mode;
+import org.openjdk.jmh.annotations.OperationsPerInvocation;
+import org.openjdk.jmh.annotations.OutputTimeUnit;
+import org.openjdk.jmh.annotations.Param;
+import org.openjdk.jmh.annotations.Scope;
+import org.openjdk.jmh.annotations.Setup;
+import org.openjdk.jmh.annotations.State;
+import org.openjdk.jmh.annotations.TearDown;
+import org.openjdk.jmh.annotations.Warmup;
+import org.openjdk.jmh.runner.Runner;
+import org.openjdk.jmh.runner.options.OptionsBuilder;
+import run.endive.runtime.ExportFunction;
+import run.endive.runtime.HostFunction;
+import run.endive.runtime.ImportValues;
+import run.endive.runtime.Instance;
+import run.endive.runtime.Memory;
+import run.endive.wasi.WasiOptions;
+import run.endive.wasi.WasiPreview1;
+import run.endive.wasm.types.FunctionType;
+import run.endive.wasm.types.ValType;
+
+import java.io.ByteArrayOutputStream;
+import java.net.URISyntaxException;
+import java.nio.ByteBuffer;
+import java.nio.ByteOrder;
+import java.nio.charset.StandardCharsets;
+import java.nio.file.Path;
+import java.util.List;
+import java.util.concurrent.TimeUnit;
+import java.util.function.Consumer;
+
+import static java.util.Objects.requireNonNull;
+
+@State(Scope.Thread)
+@OutputTimeUnit(TimeUnit.NANOSECONDS)
+@BenchmarkMode(Mode.AverageTime)
+@Fork(1)
+@Warmup(iterations = 5, time = 1)
+@Measurement(iterations = 10, time = 1)
+public class BenchmarkPythonHost
+{
+    private static final int BATCH_ROWS = 1024;
+
+    // type codes from pyhost.h
+    private static final int ROW = 0;
+    private static final int ARRAY = 1;
+    private static final int MAP = 2;
+    private static final int BOOLEAN = 3;
+    private static final int BIGINT = 4;
+    private static final int INTEGER = 5;
+    private static final int SMALLINT = 6;
+    private static final int TINYINT = 7;
+    private static final int DOUBLE = 8;
+    private static final int REAL = 9;
+    private static final int DECIMAL = 10;
+    private static final int VARCHAR = 11;
+    private static final int VARBINARY = 12;
+    private static final int DATE = 13;
+    private static final int TIME = 14;
+    private static final int TIME_WITH_TIME_ZONE = 15;
+    private static final int TIMESTAMP = 16;
+    private static final int TIMESTAMP_WITH_TIME_ZONE = 17;
+    private static final int INTERVAL_YEAR_TO_MONTH = 18;
+    private static final int INTERVAL_DAY_TO_SECOND = 19;
+    private static final int JSON = 20;
+    private static final int UUID = 21;
+    private static final int IPADDRESS = 22;
+    private static final int NUMBER = 23;
+    private static final int UNSCALED_DECIMAL = 24;
+
+    public enum BenchmarkType
+    {
+        TYPE_BOOLEAN(new int[] {BOOLEAN}, value -> value.put((byte) 1)),
+        TYPE_BIGINT(new int[] {BIGINT}, value -> value.putLong(1234567890123L)),
+        TYPE_INTEGER(new int[] {INTEGER}, value -> value.putInt(123456789)),
+        TYPE_SMALLINT(new int[] {SMALLINT}, value -> value.putShort((short) 12345)),
+        TYPE_TINYINT(new int[] {TINYINT}, value -> value.put((byte) 123)),
+        TYPE_DOUBLE(new int[] {DOUBLE}, value -> value.putDouble(Math.PI)),
+        TYPE_REAL(new int[] {REAL}, value -> value.putFloat((float) Math.E)),
+        TYPE_DECIMAL(new int[] {DECIMAL}, value -> putString(value, "12345678.90")),
+        TYPE_UNSCALED_DECIMAL(new int[] {UNSCALED_DECIMAL, 10, 2}, value -> value.putLong(1234567890L)),
+        TYPE_NUMBER(new int[] {NUMBER}, value -> putString(value, "3.14159265358979323846")),
+        TYPE_VARCHAR(new int[] {VARCHAR}, value -> putString(value, "The quick brown fox jumps over the lazy dog")),
+        TYPE_VARBINARY(new int[] {VARBINARY}, value -> putString(value, "\u0000\u0001\u0002\u0003\u0004\u0005\u0006\u0007")),
+        TYPE_JSON(new int[] {JSON}, value -> putString(value, "{\"name\": \"trino\", \"tags\": [1, 2, 3]}")),
+        TYPE_DATE(new int[] {DATE}, value -> value.putInt(20000)),
+        TYPE_TIME(new int[] {TIME}, value -> value.putLong(45_296_789_000L)),
+        TYPE_TIME_WITH_TIME_ZONE(new int[] {TIME_WITH_TIME_ZONE}, value -> value.putLong(45_296_789_000L).putShort((short) -300)),
+        TYPE_TIMESTAMP(new int[] {TIMESTAMP}, value -> value.putLong(1_700_000_000_123_456L)),
+        TYPE_TIMESTAMP_WITH_TIME_ZONE(new int[] {TIMESTAMP_WITH_TIME_ZONE}, value -> value.putLong(1_700_000_000_123_456L).putShort((short) 60)),
+        TYPE_INTERVAL_YEAR_TO_MONTH(new int[] {INTERVAL_YEAR_TO_MONTH}, value -> value.putInt(27)),
+        TYPE_INTERVAL_DAY_TO_SECOND(new int[] {INTERVAL_DAY_TO_SECOND}, value -> value.putLong(93_784_005L)),
+        TYPE_UUID(new int[] {UUID}, value -> value.putLong(0x0123456789abcdefL).putLong(0xfedcba9876543210L)),
+        TYPE_IPADDRESS(new int[] {IPADDRESS}, value -> value.putLong(0).putInt(0xffff0000).putInt(0x0100a8c0)),
+        TYPE_ARRAY_BIGINT(new int[] {ARRAY, BIGINT}, value -> {
+            value.putInt(16);
+            for (int i = 0; i < 16; i++) {
+                value.put((byte) 1).putLong(i);
+            }
+        }),
+        TYPE_ROW_ARRAY_VARCHAR_MAP_VARCHAR_BIGINT(new int[] {ROW, 2, ARRAY, VARCHAR, MAP, VARCHAR, BIGINT}, value -> {
+            value.put((byte) 1).putInt(4);
+            for (int i = 0; i < 4; i++) {
+                value.put((byte) 1);
+                putString(value, "element" + i);
+            }
+            value.put((byte) 1).putInt(4);
+            for (int i = 0; i < 4; i++) {
+                value.put((byte) 1);
+                putString(value, "key" + i);
+                value.put((byte) 1).putLong(i);
+            }
+        });
+
+        private final int[] type;
+        private final Consumer<ByteBuffer> value;
+
+        BenchmarkType(int[] type, Consumer<ByteBuffer> value)
+        {
+            this.type = requireNonNull(type, "type is null");
+            this.value = requireNonNull(value, "value is null");
+        }
+
+        public int[] returnType()
+        {
+            return type;
+        }
+
+        public int[] argumentType()
+        {
+            int[] row = new int[type.length + 2];
+            row[0] = ROW;
+            row[1] = 1;
+            System.arraycopy(type, 0, row, 2, type.length);
+            return row;
+        }
+
+        // argument record: present row with one present field
+        public byte[] record()
+        {
+            ByteBuffer buffer = ByteBuffer.allocate(4096).order(ByteOrder.LITTLE_ENDIAN);
+            buffer.put((byte) 1).put((byte) 1);
+            value.accept(buffer);
+            byte[] record = new byte[buffer.position()];
+            buffer.flip().get(record);
+            return record;
+        }
+
+        private static void putString(ByteBuffer buffer, String value)
+        {
+            byte[] bytes = value.getBytes(StandardCharsets.UTF_8);
+            buffer.putInt(bytes.length).put(bytes);
+        }
+    }
+
+    @State(Scope.Thread)
+    public static class ExecuteState
+    {
+        @Param
+        public BenchmarkType type;
+
+        @Param({"identity", "is_null"})
+        public String function;
+
+        private PythonHost host;
+        private int record;
+        private int batch;
+
+        @Setup
+        public void setup()
+        {
+            host = new PythonHost();
+            int[] returnType = function.equals("is_null") ? new int[] {BOOLEAN} : type.returnType();
+            host.setup(function, type.argumentType(), returnType);
+
+            byte[] bytes = type.record();
+            record = host.write(bytes);
+            ByteArrayOutputStream rows = new ByteArrayOutputStream();
+            for (int i = 0; i < BATCH_ROWS; i++) {
+                rows.writeBytes(bytes);
+            }
+            batch = host.write(rows.toByteArray());
+        }
+
+        @TearDown
+        public void tearDown()
+        {
+            host.deallocate(record);
+            host.deallocate(batch);
+        }
+    }
+
+    @Benchmark
+    public int execute(ExecuteState state)
+    {
+        int result = state.host.execute(state.record);
+        int size = state.host.memory().readInt(result);
+        state.host.deallocate(result);
+        return size;
+    }
+
+    @Benchmark
+    @OperationsPerInvocation(BATCH_ROWS)
+    public int executeBatch(ExecuteState state)
+    {
+        int result = state.host.executeBatch(BATCH_ROWS, state.batch);
+        return state.host.memory().readInt(result);
+    }
+
+    // cold start of a snapshotted instance: instantiation, up to the first function being ready
+    @Benchmark
+    @BenchmarkMode(Mode.SingleShotTime)
+    @OutputTimeUnit(TimeUnit.MILLISECONDS)
+    @Warmup(iterations = 5, batchSize = 1)
+    @Measurement(iterations = 20, batchSize = 1)
+    public int coldStart()
+    {
+        BenchmarkType type = BenchmarkType.TYPE_BIGINT;
+        PythonHost host = new PythonHost();
+        return host.setup("identity", type.argumentType(), type.returnType());
+    }
+
+    private static final class PythonHost
+    {
+        private final Instance instance;
+        private final ExportFunction allocate;
+        private final ExportFunction deallocate;
+        private final ExportFunction setup;
+        private final ExportFunction execute;
+        private final ExportFunction executeBatch;
+
+        public PythonHost()
+        {
+            WasiOptions options = WasiOptions.builder()
+                    .inheritSystem()
+                    .withDirectory("/guest", guestDirectory())
+                    .build();
+            WasiPreview1 wasi = WasiPreview1.builder().withOptions(options).build();
+
+            HostFunction returnError = new HostFunction(
+                    "trino",
+                    "return_error",
+                    FunctionType.of(List.of(ValType.I32, ValType.I32, ValType.I32, ValType.I32, ValType.I32), List.of()),
+                    (instance, args) -> {
+                        String message = instance.memory().readString((int) args[1], (int) args[2]);
+                        throw new RuntimeException("Guest error %s: %s".formatted(args[0], message));
+                    });
+
+            // the benchmarks pass no streamed arguments
+            HostFunction readChunk = new HostFunction(
+                    "trino",
+                    "read_chunk",
+                    FunctionType.of(List.of(ValType.I32, ValType.I32, ValType.I32), List.of(ValType.I32)),
+                    (instance, args) -> new long[] {-1});
+
+            ImportValues imports = ImportValues.builder()
+                    .addFunction(wasi.toHostFunctions())
+                    .addFunction(returnError)
+                    .addFunction(readChunk)
+                    .build();
+
+            instance = Instance.builder(Python.load())
+                    .withImportValues(imports)
+                    .withMachineFactory(Python::create)
+                    .withStart(false)
+                    .build();
+
+            allocate = instance.export("allocate");
+            deallocate = instance.export("deallocate");
+            setup = instance.export("setup");
+            execute = instance.export("execute");
+            executeBatch = instance.export("execute_batch");
+        }
+
+        public Memory memory()
+        {
+            return instance.memory();
+        }
+
+        public int write(byte[] bytes)
+        {
+            int address = (int) allocate.apply(bytes.length)[0];
+            memory().write(address, bytes);
+            return address;
+        }
+
+        public void deallocate(int address)
+        {
+            deallocate.apply(address);
+        }
+
+        public int setup(String name, int[] argType, int[] returnType)
+        {
+            int nameAddress = write((name + "\0").getBytes(StandardCharsets.UTF_8));
+            int argAddress = write(toBytes(argType));
+            int returnAddress = write(toBytes(returnType));
+            int handle = (int) setup.apply(nameAddress, argAddress, returnAddress)[0];
+            deallocate(nameAddress);
+            deallocate(argAddress);
+            deallocate(returnAddress);
+            return handle;
+        }
+
+        public int execute(int record)
+        {
+            return (int) execute.apply(record)[0];
+        }
+
+        public int executeBatch(int rowCount, int records)
+        {
+            return (int) executeBatch.apply(rowCount, records)[0];
+        }
+
+        private static byte[] toBytes(int[] values)
+        {
+            ByteBuffer buffer = ByteBuffer.allocate(values.length * Integer.BYTES).order(ByteOrder.LITTLE_ENDIAN);
+            buffer.asIntBuffer().put(values);
+            return buffer.array();
+        }
+
+        private static Path guestDirectory()
+        {
+            try {
+                return Path.of(requireNonNull(BenchmarkPythonHost.class.getResource("/benchmark"), "benchmark guest not found").toURI());
+            }
+            catch (URISyntaxException e) {
+                throw new RuntimeException(e);
+            }
+        }
+    }
+
+    public static void main(String[] args)
+            throws Exception
+    {
+        new Runner(new OptionsBuilder()
+                .include(BenchmarkPythonHost.class.getSimpleName())
+                .build())
+                .run();
+    }
+}
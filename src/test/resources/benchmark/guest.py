@@ -0,0 +1,9 @@
+# Functions used by the marshalling benchmarks
+
+
+def identity(value):
+    return value
+
+
+def is_null(value):
+    return value is None
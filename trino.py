@@ -1,6 +1,10 @@
+from collections.abc import Mapping, MutableSequence, Sequence
 from decimal import Decimal
+from io import BufferedReader, RawIOBase, TextIOWrapper
 from traceback import format_exception
 
+import _pyhost
+
 INVALID_FUNCTION_ARGUMENT = 7
 DIVISION_BY_ZERO = 8
 INVALID_CAST_ARGUMENT = 9
@@ -26,19 +30,136 @@ class NumericValueOutOfRangeError(TrinoError):
         super().__init__(NUMERIC_VALUE_OUT_OF_RANGE, message)
 
 
-def _trino_error_result(e: BaseException):
-    traceback = ''.join(format_exception(e))
-    if isinstance(e, ZeroDivisionError):
-        return DIVISION_BY_ZERO, str(e), traceback
-    if isinstance(e, TrinoError):
-        return e.error_code, str(e), traceback
-    if isinstance(e, MemoryError):
-        return EXCEEDED_FUNCTION_MEMORY_LIMIT, 'Python MemoryError', traceback
-    message = type(e).__name__
-    value = str(e)
-    if value:
-        message += ': ' + value
-    return FUNCTION_IMPLEMENTATION_ERROR, message, traceback
+def vectorized(function):
+    """Invoke the function once per batch with a memoryview for each argument
+    column, and expect a column of results supporting the buffer protocol.
+    Arguments and result must be fixed width numeric types. A null argument
+    produces a null result for its row. The argument columns are only valid
+    until the function returns.
+    """
+    function.__trino_vectorized__ = True
+    return function
+
+
+def zero_copy(function=None, *, varchar=False):
+    """Pass VARBINARY arguments, and VARCHAR arguments if varchar is set, as
+    read-only memoryviews over the argument data instead of copying them.
+    The views are released when the function returns. Arguments streamed
+    by trino.chunked are passed as files regardless.
+    """
+    def decorate(function):
+        function.__trino_zero_copy__ = True
+        function.__trino_zero_copy_varchar__ = varchar
+        return function
+
+    return decorate if function is None else decorate(function)
+
+
+def memoize(function=None, *, max_bytes=1024 * 1024):
+    """Cache the results of a deterministic function by its encoded
+    arguments, so that repeated arguments return the cached result without
+    invoking the function. The cache holds up to max_bytes of arguments and
+    results. Errors are not cached, and execute_columnar does not use the
+    cache.
+    """
+    def decorate(function):
+        function.__trino_memoize__ = max_bytes
+        return function
+
+    return decorate if function is None else decorate(function)
+
+
+def lazy(function=None, *, maps=True, arrays=True, rows=True):
+    """Pass MAP, ARRAY and ROW arguments, and values nested in them, as
+    read-only proxies that decode elements as they are accessed instead of
+    building a dict, list or tuple of every element. This suits functions
+    that look at a few elements of large values. Mutating an array proxy
+    copies it into a list the first time.
+    """
+    def decorate(function):
+        function.__trino_lazy__ = True
+        function.__trino_lazy_maps__ = maps
+        function.__trino_lazy_arrays__ = arrays
+        function.__trino_lazy_rows__ = rows
+        return function
+
+    return decorate if function is None else decorate(function)
+
+
+def returns(hint):
+    """Declare the Python type of the result, such as list[int] or
+    dict[str, float], in place of the return annotation. For the parts of
+    the result declared with builtin types, results are encoded by a fast
+    path for values of exactly that type, and other values still take the
+    generic conversions.
+    """
+    def decorate(function):
+        function.__trino_returns__ = hint
+        return function
+
+    return decorate
+
+
+def chunked(function=None, *, arguments=None):
+    """Pass large VARCHAR and VARBINARY arguments as file objects that read
+    the value from Trino in chunks as it is consumed, so it is never held in
+    full. VARCHAR values are UTF-8 text files, and VARBINARY values binary
+    files. arguments lists the positions of the arguments to stream, and
+    defaults to all of them. The files are closed when the function returns.
+    Memoization does not apply to chunked functions. Streamed arguments take
+    precedence over trino.zero_copy and trino.lazy, which apply to the other
+    arguments.
+    """
+    if arguments is not None:
+        arguments = tuple(arguments)
+        for position in arguments:
+            if not 0 <= position < 31:
+                raise ValueError(f'chunked argument position must be between 0 and 30: {position}')
+
+    def decorate(function):
+        if arguments is None:
+            function.__trino_chunked__ = -1
+        else:
+            function.__trino_chunked__ = sum(1 << position for position in set(arguments))
+        return function
+
+    return decorate if function is None else decorate(function)
+
+
+class ChunkReader(RawIOBase):
+    """Raw binary stream of an argument passed by trino.chunked."""
+
+    def __init__(self, stream):
+        self._stream = stream
+
+    def readable(self):
+        return True
+
+    def readinto(self, buffer):
+        if self.closed:
+            raise ValueError('I/O operation on closed file')
+        return _pyhost.read_chunk(self._stream, buffer)
+
+
+class LazyMap(_pyhost.LazyMap, Mapping):
+    __slots__ = ()
+
+
+class LazyArray(_pyhost.LazyArray, MutableSequence):
+    __slots__ = ()
+
+
+class LazyRow(_pyhost.LazyRow, Sequence):
+    __slots__ = ()
+
+
+def _open_chunked(stream: int, text: bool):
+    file = BufferedReader(ChunkReader(stream))
+    return TextIOWrapper(file, encoding='utf-8') if text else file
+
+
+def _trino_format_traceback(e: BaseException):
+    return ''.join(format_exception(e))
 
 
 def _decimal_to_string(value: Decimal):